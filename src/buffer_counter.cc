@@ -0,0 +1,171 @@
+// Copyright 2018 Kurt Kanzenbach <kurt@kmk-computers.de>
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#include <vector>
+#include <cwctype>
+#include <cstring>
+#include <algorithm>
+
+#include "buffer_counter.h"
+
+// parts smaller than that aren't worth waking up another thread
+static constexpr std::size_t MIN_PART = 256 * 1024;
+
+static WordCountResult to_result(const CountKernel::Counts& counts, std::size_t bytes)
+{
+    WordCountResult result;
+
+    result.bytes()   = bytes;
+    result.lines()   = counts.lines;
+    result.words()   = counts.words;
+    result.chars()   = counts.chars;
+    result.invalid() = counts.invalid;
+
+    return result;
+}
+
+BufferCounter::BufferCounter(const KwcNGConfig& config, ThreadPool& pool) :
+    m_config{config},
+    m_count_bytes{nullptr},
+    m_pool{pool},
+    m_bytes{0},
+    m_prev{L' '},
+    m_carried{0}
+{
+    std::uint32_t metrics = 0;
+
+    if (!(m_config.flags & (KwcNGOpt::LINES | KwcNGOpt::WORDS | KwcNGOpt::CHARS |
+                            KwcNGOpt::BYTES)))
+        m_config.flags |= KwcNGOpt::LINES | KwcNGOpt::WORDS | KwcNGOpt::CHARS;
+
+    if (m_config.flags & KwcNGOpt::LINES)
+        metrics |= CountKernel::LINES;
+    if (m_config.flags & KwcNGOpt::WORDS)
+        metrics |= CountKernel::WORDS;
+    if (m_config.flags & KwcNGOpt::CHARS)
+        metrics |= CountKernel::CHARS;
+    if (m_config.flags & KwcNGOpt::VALIDATE)
+        metrics |= CountKernel::VALIDATE;
+
+    m_count_bytes = CountKernel::get().variant(metrics);
+}
+
+WordCountResult BufferCounter::count(std::string_view data)
+{
+    CountKernel::Counts counts;
+
+    count(reinterpret_cast<const unsigned char *>(data.data()), data.size(), L' ', counts);
+
+    return to_result(counts, data.size());
+}
+
+void BufferCounter::feed(std::string_view data)
+{
+    auto bytes = reinterpret_cast<const unsigned char *>(data.data());
+    auto size = data.size();
+
+    m_bytes += size;
+    // complete the character carried over from the last buffer
+    if (m_carried) {
+        unsigned char buffer[Utf8::MAX_CARRY + 1];
+        std::size_t len = m_carried;
+
+        std::memcpy(buffer, m_carry, m_carried);
+        while (len - m_carried < size && len < sizeof(buffer) &&
+               Utf8::is_continuation(bytes[len - m_carried])) {
+            buffer[len] = bytes[len - m_carried];
+            len++;
+        }
+
+        if (len - m_carried == size && Utf8::boundary(buffer, len) < len) {
+            std::memcpy(m_carry, buffer, len);
+            m_carried = len;
+            return;
+        }
+
+        count(buffer, len, m_prev, m_stream);
+        m_prev = Utf8::prev_char(buffer, buffer + len);
+        bytes += len - m_carried;
+        size -= len - m_carried;
+        m_carried = 0;
+    }
+
+    auto end = Utf8::boundary(bytes, size);
+
+    count(bytes, end, m_prev, m_stream);
+    if (end)
+        m_prev = Utf8::prev_char(bytes, bytes + end);
+
+    m_carried = size - end;
+    std::memcpy(m_carry, bytes + end, m_carried);
+}
+
+WordCountResult BufferCounter::finish()
+{
+    // an incomplete character at the end is counted as is
+    count(m_carry, m_carried, m_prev, m_stream);
+
+    auto result = to_result(m_stream, m_bytes);
+
+    m_stream = CountKernel::Counts{};
+    m_bytes = 0;
+    m_prev = L' ';
+    m_carried = 0;
+
+    return result;
+}
+
+void BufferCounter::count(const unsigned char *data, std::size_t size, wchar_t prev,
+                          CountKernel::Counts& counts)
+{
+    const auto part = std::max(m_config.chunk_size, MIN_PART);
+    const auto threads = std::min(m_pool.size(), std::max<std::size_t>(m_config.max_threads, 1));
+    const auto parts = std::min(threads, (size + part - 1) / part);
+
+    if (parts <= 1) {
+        bool prev_space = std::iswspace(prev);
+
+        m_count_bytes(data, size, prev_space, counts);
+        return;
+    }
+
+    std::vector<CountKernel::Counts> results(parts);
+
+    m_pool.run(parts, [&] (std::size_t i) {
+        auto begin = i ? Utf8::align(data, i * size / parts, size) : 0;
+        auto end = i + 1 < parts ? Utf8::align(data, (i + 1) * size / parts, size) : size;
+        bool prev_space = std::iswspace(i ? Utf8::prev_char(data, data + begin) : prev);
+
+        if (begin < end)
+            m_count_bytes(data + begin, end - begin, prev_space, results[i]);
+    });
+
+    for (auto&& result: results) {
+        counts.lines   += result.lines;
+        counts.words   += result.words;
+        counts.chars   += result.chars;
+        counts.invalid += result.invalid;
+    }
+}
@@ -0,0 +1,88 @@
+// Copyright 2018 Kurt Kanzenbach <kurt@kmk-computers.de>
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef _BUFFER_COUNTER_H_
+#define _BUFFER_COUNTER_H_
+
+#include <string_view>
+#include <cstddef>
+
+#include "config.h"
+#include "utf8.h"
+#include "thread_pool.h"
+#include "count_kernel.h"
+#include "word_count_result.h"
+
+/**
+ * Counts buffers which are already held in memory on behalf of a
+ * WordCounter.
+ *
+ * Only the metric flags, max_threads and chunk_size of the config are
+ * used. Without any metric all of them are counted, like on the command
+ * line. The input is counted as UTF-8. Whitespace beyond ASCII is classified
+ * by the current locale, so a UTF-8 locale should be set.
+ *
+ * Large buffers are split at character boundaries and counted by the
+ * thread pool of the word counter, which persists across calls. As the
+ * whole buffer is at hand, every part knows the character in front of it
+ * and no words have to be corrected afterwards.
+ *
+ * feed() and finish() count a stream of buffers, characters and words
+ * may be split between them. A counter is meant to be used by one thread
+ * at a time.
+ */
+class BufferCounter
+{
+public:
+    BufferCounter(const KwcNGConfig& config, ThreadPool& pool);
+
+    /**
+     * Counts @data on its own, independent of the stream.
+     */
+    WordCountResult count(std::string_view data);
+
+    void feed(std::string_view data);
+
+    /**
+     * Returns the counts of everything fed since the last call and starts
+     * over.
+     */
+    WordCountResult finish();
+
+private:
+    void count(const unsigned char *data, std::size_t size, wchar_t prev,
+               CountKernel::Counts& counts);
+
+    KwcNGConfig m_config;
+    CountKernel::Count m_count_bytes;
+    ThreadPool& m_pool;
+    CountKernel::Counts m_stream;
+    std::size_t m_bytes;
+    wchar_t m_prev;
+    unsigned char m_carry[Utf8::MAX_CARRY];
+    std::size_t m_carried;
+};
+
+#endif /* _BUFFER_COUNTER_H_ */
@@ -0,0 +1,147 @@
+// Copyright 2018 Kurt Kanzenbach <kurt@kmk-computers.de>
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef _CHUNK_SIZER_H_
+#define _CHUNK_SIZER_H_
+
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+/**
+ * Adapts the chunk size at runtime.
+ *
+ * The initial size is derived from the total input size, the number of
+ * counting threads and the L2 cache size. Afterwards, the counting
+ * threads report how long they've spent counting and waiting for the
+ * queue. Chunks grow if the threads starve or the per chunk overhead
+ * dominates, and shrink if single chunks take so long that the load
+ * balancing suffers. Only mapped files use larger chunks than the initial
+ * size, the buffers of the stream readers are allocated with that.
+ */
+class ChunkSizer
+{
+public:
+    static constexpr std::size_t MIN_SIZE = 16 * 1024;
+    static constexpr std::size_t MAX_SIZE = 4 * 1024 * 1024;
+
+    // chunks a counting thread sums up before reporting
+    static constexpr std::size_t SAMPLES = 64;
+
+    // per chunk counting time considered as reasonable
+    static constexpr std::uint64_t MIN_COUNT_NS = 100 * 1000;
+    static constexpr std::uint64_t MAX_COUNT_NS = 5 * 1000 * 1000;
+
+    struct Sample {
+        std::uint64_t count_ns{0};
+        std::uint64_t wait_ns{0};
+        std::size_t chunks{0};
+    };
+
+    explicit ChunkSizer(std::size_t size) :
+        m_initial{size}, m_size{size}, m_min{size}, m_max{size}
+    {}
+
+    /**
+     * Every counting thread should get a few dozen chunks, while a chunk
+     * should still fit into half of the L2 cache.
+     */
+    static std::size_t initial(const std::vector<std::string>& files, std::size_t workers)
+    {
+        auto cache = ::sysconf(_SC_LEVEL2_CACHE_SIZE);
+        std::size_t limit = cache > 0 ? cache / 2 : 512 * 1024;
+        std::size_t total = 0;
+        bool unknown = false;
+
+        for (auto&& file: files) {
+            struct stat st;
+            int ret = file == "stdin" ?
+                ::fstat(STDIN_FILENO, &st) : ::stat(file.c_str(), &st);
+
+            if (ret || !S_ISREG(st.st_mode))
+                unknown = true;
+            else
+                total += st.st_size;
+        }
+
+        auto size = unknown ? limit : total / (workers * 32);
+
+        size = std::clamp(size, MIN_SIZE, std::clamp(limit, MIN_SIZE, MAX_SIZE));
+
+        return size & ~static_cast<std::size_t>(4095);
+    }
+
+    std::size_t size() const noexcept
+    {
+        return m_size.load(std::memory_order_relaxed);
+    }
+
+    std::size_t initial() const noexcept
+    {
+        return m_initial;
+    }
+
+    std::size_t min() const noexcept
+    {
+        return m_min;
+    }
+
+    std::size_t max() const noexcept
+    {
+        return m_max;
+    }
+
+    void report(const Sample& sample)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto size = m_size.load(std::memory_order_relaxed);
+        auto per_chunk = sample.count_ns / std::max<std::size_t>(sample.chunks, 1);
+
+        if (sample.wait_ns > sample.count_ns || per_chunk < MIN_COUNT_NS)
+            size = std::min(size * 2, MAX_SIZE);
+        else if (per_chunk > MAX_COUNT_NS)
+            size = std::max(size / 2, MIN_SIZE);
+
+        m_min = std::min(m_min, size);
+        m_max = std::max(m_max, size);
+        m_size.store(size, std::memory_order_relaxed);
+    }
+
+private:
+    std::size_t m_initial;
+    std::atomic<std::size_t> m_size;
+    std::size_t m_min;
+    std::size_t m_max;
+    std::mutex m_mutex;
+};
+
+#endif /* _CHUNK_SIZER_H_ */
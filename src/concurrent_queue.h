@@ -25,68 +25,258 @@
 #ifndef _CONCURRENT_QUEUE_H_
 #define _CONCURRENT_QUEUE_H_
 
-#include <queue>
 #include <mutex>
 #include <thread>
 #include <atomic>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
 #include <condition_variable>
 
+static constexpr std::size_t CACHE_LINE_SIZE = 64;
+
+static inline void cpu_relax() noexcept
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#else
+    std::this_thread::yield();
+#endif
+}
+
 /**
- * Basic implementation of a WorkQueue used in producer/consumer scenario.
+ * Bounded lock-free multi producer multi consumer queue used in producer/
+ * consumer scenario.
  *
- * Locking is performed as described in:
- *   http://en.cppreference.com/w/cpp/thread/condition_variable
+ * The ring follows Dmitry Vyukov's bounded MPMC queue: Every cell carries
+ * a sequence number which tells producers and consumers whether it's
+ * their turn. Producers and consumers only contend on one atomic index
+ * each, which live in separate cache lines.
  *
- * The combination from unique_locks and condition variables results
- * in really short and correct code. Nice!
+ * The capacity is fixed. A full queue blocks the producer, so a fast
+ * reader cannot pile up an entire file in memory. Both sides spin for a
+ * short while before they park on a condition variable. The mutex is
+ * only ever taken for parking and waking up parked threads.
  */
 template<typename T>
 class ConcurrentQueue
 {
 public:
-    ConcurrentQueue() :
+    explicit ConcurrentQueue(std::size_t capacity) :
+        m_capacity{round_up(capacity)},
+        m_cells{new Cell[m_capacity]},
+        m_head{0}, m_tail{0},
+        m_push_waiters{0}, m_pop_waiters{0},
         m_stop{false}
-    {}
+    {
+        for (std::size_t i = 0; i < m_capacity; ++i)
+            m_cells[i].seq.store(i, std::memory_order_relaxed);
+    }
 
     void push(T&& element)
     {
+        for (int i = 0; i < SPIN_COUNT; ++i) {
+            if (try_push(element))
+                return;
+            cpu_relax();
+        }
+
         {
-            std::lock_guard<std::mutex> lock(m_mutex);
+            std::unique_lock<std::mutex> lock(m_mutex);
 
-            m_queue.push(std::forward<T>(element));
+            m_push_waiters++;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            m_not_full.wait(lock, [&] { return enqueue(element); });
+            m_push_waiters--;
         }
-        m_cv.notify_one();
+
+        wake(m_pop_waiters, m_not_empty);
     }
 
     T pop()
     {
-        std::unique_lock<std::mutex> lock(m_mutex);
-
-        m_cv.wait(lock, [this] { return !m_queue.empty() || m_stop; });
-        if (m_stop && m_queue.empty())
-            return T();
-        auto element = std::move(m_queue.front());
-        m_queue.pop();
-        return element;
+        bool popped = false;
+        T element;
+
+        for (int i = 0; i < SPIN_COUNT; ++i) {
+            if (try_pop(element))
+                return element;
+            if (m_stop)
+                break;
+            cpu_relax();
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+
+            m_pop_waiters++;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            m_not_empty.wait(lock, [&] { return (popped = dequeue(element)) || m_stop; });
+            m_pop_waiters--;
+        }
+
+        if (popped) {
+            wake(m_push_waiters, m_not_full);
+            return element;
+        }
+
+        // drain the queue before giving up
+        if (try_pop(element))
+            return element;
+
+        return T();
     }
 
-    bool empty()
+    bool try_push(T& element)
     {
-        std::lock_guard<std::mutex> lock{m_mutex};
-        return m_queue.empty();
+        if (!enqueue(element))
+            return false;
+
+        wake(m_pop_waiters, m_not_empty);
+
+        return true;
+    }
+
+    bool try_pop(T& element)
+    {
+        if (!dequeue(element))
+            return false;
+
+        wake(m_push_waiters, m_not_full);
+
+        return true;
+    }
+
+    bool empty() const
+    {
+        return size() == 0;
+    }
+
+    std::size_t size() const
+    {
+        return m_tail.value.load() - m_head.value.load();
+    }
+
+    std::size_t capacity() const noexcept
+    {
+        return m_capacity;
     }
 
     void wake_up()
     {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
         m_stop = true;
-        m_cv.notify_all();
+        m_not_empty.notify_all();
+    }
+
+    /**
+     * Undoes wake_up() once all consumers have returned, so that pop()
+     * blocks again.
+     */
+    void reset()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        m_stop = false;
     }
 
 private:
-    std::queue<T> m_queue;
-    std::mutex m_mutex;
-    std::condition_variable m_cv;
+    static constexpr int SPIN_COUNT = 128;
+
+    struct alignas(CACHE_LINE_SIZE) Cell {
+        std::atomic<std::size_t> seq;
+        T element;
+    };
+
+    struct alignas(CACHE_LINE_SIZE) Index {
+        Index(std::size_t v) : value{v} {}
+        std::atomic<std::size_t> value;
+    };
+
+    static std::size_t round_up(std::size_t capacity)
+    {
+        std::size_t size = 2;
+
+        while (size < capacity)
+            size <<= 1;
+
+        return size;
+    }
+
+    bool enqueue(T& element)
+    {
+        auto pos = m_tail.value.load(std::memory_order_relaxed);
+        Cell *cell;
+
+        while (42) {
+            cell = &m_cells[pos & (m_capacity - 1)];
+            auto seq = cell->seq.load(std::memory_order_acquire);
+            auto diff = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos);
+
+            if (diff == 0) {
+                if (m_tail.value.compare_exchange_weak(pos, pos + 1,
+                                                       std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0)
+                return false;
+            else
+                pos = m_tail.value.load(std::memory_order_relaxed);
+        }
+
+        cell->element = std::move(element);
+        cell->seq.store(pos + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    bool dequeue(T& element)
+    {
+        auto pos = m_head.value.load(std::memory_order_relaxed);
+        Cell *cell;
+
+        while (42) {
+            cell = &m_cells[pos & (m_capacity - 1)];
+            auto seq = cell->seq.load(std::memory_order_acquire);
+            auto diff = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos + 1);
+
+            if (diff == 0) {
+                if (m_head.value.compare_exchange_weak(pos, pos + 1,
+                                                       std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0)
+                return false;
+            else
+                pos = m_head.value.load(std::memory_order_relaxed);
+        }
+
+        element = std::move(cell->element);
+        cell->seq.store(pos + m_capacity, std::memory_order_release);
+
+        return true;
+    }
+
+    void wake(std::atomic<std::size_t>& waiters, std::condition_variable& cv)
+    {
+        // pairs with the fence of the parking side, see push() and pop()
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!waiters.load(std::memory_order_relaxed))
+            return;
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        cv.notify_one();
+    }
+
+    const std::size_t m_capacity;
+    std::unique_ptr<Cell[]> m_cells;
+    Index m_head;
+    Index m_tail;
+    std::atomic<std::size_t> m_push_waiters;
+    std::atomic<std::size_t> m_pop_waiters;
     std::atomic<bool> m_stop;
+    std::mutex m_mutex;
+    std::condition_variable m_not_full;
+    std::condition_variable m_not_empty;
 };
 
 #endif /* _CONCURRENT_QUEUE_H_ */
@@ -1,3 +0,0 @@
-#include "config.h"
-
-KwcNGConfig config;
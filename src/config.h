@@ -26,15 +26,29 @@
 #define _CONFIG_H_
 
 #include <thread>
+#include <string>
+#include <vector>
 #include <cstdint>
 
 #include <gfm/gfm.h>
 
 enum class KwcNGOpt: std::uint32_t {
-    LINES     = BIT(0),
-    WORDS     = BIT(1),
-    CHARS     = BIT(2),
-    PARSEABLE = BIT(3),
+    LINES           = BIT(0),
+    WORDS           = BIT(1),
+    CHARS           = BIT(2),
+    PARSEABLE       = BIT(3),
+    VALIDATE        = BIT(4),
+    STEAL           = BIT(5),
+    AUTO_CHUNK_SIZE = BIT(6),
+    IO_URING        = BIT(7),
+    DIRECT          = BIT(8),
+    RECURSIVE       = BIT(9),
+    FOLLOW          = BIT(10),
+    STATS           = BIT(11),
+    BYTES           = BIT(12),
+    FREQ            = BIT(13),
+    STREAM          = BIT(14),
+    ORDERED         = BIT(15),
 };
 
 GFM_DECLARE_FLAG_MAP(KwcNGOpt);
@@ -42,15 +56,24 @@ GFM_DECLARE_FLAG_MAP(KwcNGOpt);
 struct KwcNGConfig {
     KwcNGConfig() :
         max_threads{std::thread::hardware_concurrency()},
-        chunk_size{DEFAULT_CHUNK_SIZE}
+        chunk_size{DEFAULT_CHUNK_SIZE},
+        max_inflight_bytes{0},
+        max_readers{1},
+        follow_interval{DEFAULT_FOLLOW_INTERVAL},
+        top{0}
     {}
 
     static const inline std::size_t DEFAULT_CHUNK_SIZE = 4096;
+    static const inline std::size_t DEFAULT_FOLLOW_INTERVAL = 1000;
     KwcNGOptFlags flags;
     std::size_t max_threads;
     std::size_t chunk_size;
+    std::size_t max_inflight_bytes;
+    std::size_t max_readers;
+    std::string cache_file;
+    std::size_t follow_interval;
+    std::size_t top;
+    std::vector<unsigned> cpus;
 };
 
-extern KwcNGConfig config;
-
 #endif /* _CONFIG_H_ */
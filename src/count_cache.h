@@ -0,0 +1,275 @@
+// Copyright 2018 Kurt Kanzenbach <kurt@kmk-computers.de>
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef _COUNT_CACHE_H_
+#define _COUNT_CACHE_H_
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * Persistent cache of the counts of regular files.
+ *
+ * The cache file is an array of fixed size records sorted by device,
+ * inode and metric mask, which is mapped and binary searched. A record
+ * is valid as long as size and modification time match. Besides that, a
+ * hash of the last bytes allows to detect files which have only been
+ * appended to. Then, just the new tail has to be counted.
+ *
+ * Updates are collected during the run and written to a temporary file,
+ * which replaces the cache atomically. Only the files looked up in the
+ * run are kept, so records of deleted or replaced files are dropped. The
+ * format is native endian and meant to stay on the host.
+ */
+class CountCache
+{
+public:
+    static constexpr std::size_t TAIL_BYTES = 64;
+
+    struct Record {
+        std::uint64_t dev;
+        std::uint64_t ino;
+        std::uint64_t size;
+        std::uint64_t mtime_ns;
+        std::uint64_t lines;
+        std::uint64_t words;
+        std::uint64_t chars;
+        std::uint64_t invalid;
+        std::uint64_t tail_hash;
+        std::uint32_t mask;
+        std::uint32_t reserved;
+    };
+
+    static_assert(sizeof(Record) == 80, "Records are stored as is");
+
+    explicit CountCache(const std::string& path) :
+        m_path{path}, m_data{nullptr}, m_size{0}, m_records{nullptr}, m_count{0}
+    {
+        struct stat st;
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+        if (fd < 0)
+            return;
+
+        if (!::fstat(fd, &st) && st.st_size > 0) {
+            auto data = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+            if (data != MAP_FAILED) {
+                m_data = static_cast<const char *>(data);
+                m_size = st.st_size;
+            }
+        }
+        ::close(fd);
+
+        Header header;
+        if (m_size < sizeof(header))
+            return;
+        std::memcpy(&header, m_data, sizeof(header));
+        // the count is checked before it's multiplied, so that a bogus one
+        // cannot wrap around
+        if (std::memcmp(header.magic, MAGIC, sizeof(header.magic)) ||
+            header.count > (m_size - sizeof(header)) / sizeof(Record) ||
+            m_size != sizeof(header) + header.count * sizeof(Record))
+            return;
+
+        m_records = reinterpret_cast<const Record *>(m_data + sizeof(header));
+        m_count = header.count;
+    }
+
+    CountCache(const CountCache& other) = delete;
+    CountCache& operator=(const CountCache& other) = delete;
+
+    ~CountCache()
+    {
+        if (m_data)
+            ::munmap(const_cast<char *>(m_data), m_size);
+    }
+
+    /**
+     * Whether the cache file existed, but could not be used.
+     */
+    bool corrupt() const noexcept
+    {
+        return m_data && !m_records;
+    }
+
+    const Record *find(std::uint64_t dev, std::uint64_t ino, std::uint32_t mask) const noexcept
+    {
+        Record key{};
+
+        key.dev = dev;
+        key.ino = ino;
+        key.mask = mask;
+
+        auto end = m_records + m_count;
+        auto it = std::lower_bound(m_records, end, key, less);
+
+        return it != end && !less(key, *it) ? it : nullptr;
+    }
+
+    /**
+     * FNV-1a of the up to TAIL_BYTES bytes before @size.
+     */
+    static std::uint64_t tail_hash(int fd, std::uint64_t size)
+    {
+        unsigned char buffer[TAIL_BYTES];
+        std::uint64_t hash = 0xcbf29ce484222325ULL;
+        std::size_t len = std::min<std::uint64_t>(size, TAIL_BYTES);
+        std::size_t done = 0;
+
+        while (done < len) {
+            auto ret = ::pread(fd, buffer + done, len - done, size - len + done);
+
+            if (ret < 0 && errno == EINTR)
+                continue;
+            if (ret <= 0)
+                return 0;
+            done += ret;
+        }
+
+        for (std::size_t i = 0; i < len; ++i)
+            hash = (hash ^ buffer[i]) * 0x100000001b3ULL;
+
+        return hash;
+    }
+
+    void store(const Record& record)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        m_updates.push_back(record);
+    }
+
+    /**
+     * Writes the updates merged with the old records of the same files,
+     * which keeps the records of other metric masks.
+     */
+    bool save()
+    {
+        std::vector<Record> records(m_updates);
+        // unique, so that concurrent runs don't write to the same file
+        auto tmp = m_path + ".XXXXXX";
+        Header header;
+
+        std::sort(records.begin(), records.end(), less);
+        const auto updates = records.size();
+        for (std::size_t i = 0; i < m_count; ++i)
+            if (std::binary_search(records.begin(), records.begin() + updates,
+                                   m_records[i], less_file))
+                records.push_back(m_records[i]);
+        // the updates come first and win
+        std::stable_sort(records.begin(), records.end(), less);
+        records.erase(std::unique(records.begin(), records.end(), [] (auto& a, auto& b) {
+            return !less(a, b) && !less(b, a);
+        }), records.end());
+
+        std::memcpy(header.magic, MAGIC, sizeof(header.magic));
+        header.count = records.size();
+
+        int fd = ::mkostemp(&tmp[0], O_CLOEXEC);
+        if (fd < 0)
+            return false;
+
+        // the temporary file is private, the cache keeps its permissions
+        struct stat st;
+        if (!::stat(m_path.c_str(), &st))
+            ::fchmod(fd, st.st_mode & 07777);
+
+        auto written = write_all(fd, &header, sizeof(header)) &&
+            write_all(fd, records.data(), records.size() * sizeof(Record));
+        written = !::close(fd) && written;
+
+        // a partially written file is never left behind
+        if (!written || std::rename(tmp.c_str(), m_path.c_str())) {
+            ::unlink(tmp.c_str());
+            return false;
+        }
+
+        return true;
+    }
+
+private:
+    static constexpr char MAGIC[8] = { 'K', 'W', 'C', 'N', 'G', 'C', '0', '1' };
+
+    struct Header {
+        char magic[8];
+        std::uint64_t count;
+    };
+
+    static bool less_file(const Record& a, const Record& b) noexcept
+    {
+        return a.dev < b.dev || (a.dev == b.dev && a.ino < b.ino);
+    }
+
+    static bool write_all(int fd, const void *data, std::size_t size)
+    {
+        auto p = static_cast<const char *>(data);
+
+        while (size) {
+            auto ret = ::write(fd, p, size);
+
+            if (ret < 0 && errno == EINTR)
+                continue;
+            if (ret < 0)
+                return false;
+            p += ret;
+            size -= ret;
+        }
+
+        return true;
+    }
+
+    static bool less(const Record& a, const Record& b) noexcept
+    {
+        if (a.dev != b.dev)
+            return a.dev < b.dev;
+        if (a.ino != b.ino)
+            return a.ino < b.ino;
+        return a.mask < b.mask;
+    }
+
+    std::string m_path;
+    const char *m_data;
+    std::size_t m_size;
+    const Record *m_records;
+    std::size_t m_count;
+    std::vector<Record> m_updates;
+    std::mutex m_mutex;
+};
+
+#endif /* _COUNT_CACHE_H_ */
@@ -0,0 +1,98 @@
+// Copyright 2018 Kurt Kanzenbach <kurt@kmk-computers.de>
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <cstdlib>
+#include <cstring>
+
+#include "kwcng_config.h"
+#include "count_kernel.h"
+#include "count_kernel_impl.h"
+#include "logger.h"
+
+const CountKernel scalar_kernel =
+    make_scalar_kernel(std::make_index_sequence<CountKernel::VARIANTS>());
+
+static bool supported(const CountKernel *kernel)
+{
+#ifdef KWCNG_X86_KERNELS
+    __builtin_cpu_init();
+
+    if (kernel == &avx512_kernel)
+        return __builtin_cpu_supports("avx512f") &&
+            __builtin_cpu_supports("avx512bw") &&
+            __builtin_cpu_supports("popcnt");
+    if (kernel == &avx2_kernel)
+        return __builtin_cpu_supports("avx2") &&
+            __builtin_cpu_supports("popcnt");
+    if (kernel == &sse2_kernel)
+        return __builtin_cpu_supports("sse2");
+#endif
+
+    return kernel == &scalar_kernel;
+}
+
+std::vector<const CountKernel *> CountKernel::available()
+{
+    std::vector<const CountKernel *> kernels;
+    const CountKernel *all[] = {
+#ifdef KWCNG_X86_KERNELS
+        &avx512_kernel,
+        &avx2_kernel,
+        &sse2_kernel,
+#endif
+        &scalar_kernel,
+    };
+
+    // best first
+    for (auto&& kernel: all)
+        if (supported(kernel))
+            kernels.push_back(kernel);
+
+    return kernels;
+}
+
+static const CountKernel& select_kernel()
+{
+    auto kernels = CountKernel::available();
+    auto name = std::getenv("KWCNG_KERNEL");
+
+    if (!name)
+        return *kernels.front();
+
+    for (auto&& kernel: kernels)
+        if (!std::strcmp(kernel->name, name))
+            return *kernel;
+
+    log_warn("Kernel " << name << " is not available on this machine, using "
+             << kernels.front()->name);
+
+    return *kernels.front();
+}
+
+const CountKernel& CountKernel::get()
+{
+    static const CountKernel& kernel = select_kernel();
+
+    return kernel;
+}
@@ -0,0 +1,105 @@
+// Copyright 2018 Kurt Kanzenbach <kurt@kmk-computers.de>
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef _COUNT_KERNEL_H_
+#define _COUNT_KERNEL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "kwcng_config.h"
+
+/**
+ * Counting kernels operating on UTF-8 encoded bytes.
+ *
+ * Besides the portable scalar kernel there are vectorized kernels for
+ * SSE2, AVX2 and AVX-512. They are compiled with their own instruction
+ * set flags and the best one supported by the running CPU is selected
+ * once at startup, so the binary itself stays portable.
+ *
+ * Every kernel comes in one variant per combination of metrics, which is
+ * instantiated at compile time. Thus, the inner loops only contain what's
+ * actually requested.
+ *
+ * The selection can be overridden by setting KWCNG_KERNEL to the name
+ * of a kernel, which is handy for testing and benchmarking.
+ */
+struct CountKernel {
+    /**
+     * Metrics a variant is specialized for. They are independent from
+     * KwcNGOpt on purpose: The kernel translation units are compiled with
+     * different instruction set flags and must not instantiate any inline
+     * code shared with the rest of the program.
+     */
+    enum Metric : std::uint32_t {
+        LINES    = 1 << 0,
+        WORDS    = 1 << 1,
+        CHARS    = 1 << 2,
+        VALIDATE = 1 << 3,
+    };
+
+    static constexpr std::size_t VARIANTS = 16;
+
+    struct Counts {
+        std::size_t lines{0};
+        std::size_t words{0};
+        std::size_t chars{0};
+        std::size_t invalid{0};
+    };
+
+    /**
+     * Counts the metrics of one variant and adds them to @counts:
+     *
+     *  - lines:   newlines
+     *  - words:   word starts, which is a non-whitespace character
+     *             following a whitespace character. @prev_space holds the
+     *             state of the preceding character and is updated on return.
+     *  - chars:   bytes which aren't UTF-8 continuation bytes
+     *  - invalid: invalid UTF-8 sequences, if validation is requested
+     */
+    using Count = void (*)(const unsigned char *data, std::size_t size,
+                           bool& prev_space, Counts& counts);
+
+    const char *name;
+    Count variants[VARIANTS];
+
+    Count variant(std::uint32_t metrics) const noexcept
+    {
+        return variants[metrics & (VARIANTS - 1)];
+    }
+
+    static const CountKernel& get();
+
+    static std::vector<const CountKernel *> available();
+};
+
+extern const CountKernel scalar_kernel;
+#ifdef KWCNG_X86_KERNELS
+extern const CountKernel sse2_kernel;
+extern const CountKernel avx2_kernel;
+extern const CountKernel avx512_kernel;
+#endif
+
+#endif /* _COUNT_KERNEL_H_ */
@@ -0,0 +1,87 @@
+// Copyright 2018 Kurt Kanzenbach <kurt@kmk-computers.de>
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <immintrin.h>
+
+#include "count_kernel.h"
+#include "count_kernel_impl.h"
+
+namespace {
+
+struct Avx2 {
+    using Validator = LookupValidator;
+
+    template<typename Cmp>
+    static std::uint64_t mask(const unsigned char *p, Cmp cmp)
+    {
+        auto lo = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+        auto hi = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 32));
+
+        return static_cast<std::uint32_t>(_mm256_movemask_epi8(cmp(lo))) |
+            static_cast<std::uint64_t>(
+                static_cast<std::uint32_t>(_mm256_movemask_epi8(cmp(hi)))) << 32;
+    }
+
+    // unsigned lo <= v <= hi
+    static __m256i in_range(__m256i v, char lo, char hi)
+    {
+        auto t = _mm256_sub_epi8(v, _mm256_set1_epi8(lo));
+
+        return _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8(hi - lo)), t);
+    }
+
+    static std::uint64_t newlines(const unsigned char *p)
+    {
+        return mask(p, [] (__m256i v) {
+                           return _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'));
+                       });
+    }
+
+    static std::uint64_t spaces(const unsigned char *p)
+    {
+        return mask(p, [] (__m256i v) {
+                           return _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+                                                  in_range(v, '\t', '\r'));
+                       });
+    }
+
+    static std::uint64_t special(const unsigned char *p)
+    {
+        return mask(p, [] (__m256i v) {
+                           return in_range(v, '\xe1', '\xe3');
+                       });
+    }
+
+    static std::uint64_t continuations(const unsigned char *p)
+    {
+        return mask(p, [] (__m256i v) {
+                           return _mm256_cmpgt_epi8(_mm256_set1_epi8(-64), v);
+                       });
+    }
+};
+
+}
+
+const CountKernel avx2_kernel =
+    make_simd_kernel<Avx2>("avx2", std::make_index_sequence<CountKernel::VARIANTS>());
@@ -0,0 +1,75 @@
+// Copyright 2018 Kurt Kanzenbach <kurt@kmk-computers.de>
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <immintrin.h>
+
+#include "count_kernel.h"
+#include "count_kernel_impl.h"
+
+namespace {
+
+struct Avx512 {
+    // the lookup tables are per 128 bit lane anyway
+    using Validator = LookupValidator;
+
+    static __m512i load(const unsigned char *p)
+    {
+        return _mm512_loadu_si512(p);
+    }
+
+    // unsigned lo <= v <= hi
+    static std::uint64_t in_range(__m512i v, char lo, char hi)
+    {
+        return _mm512_cmple_epu8_mask(_mm512_sub_epi8(v, _mm512_set1_epi8(lo)),
+                                      _mm512_set1_epi8(hi - lo));
+    }
+
+    static std::uint64_t newlines(const unsigned char *p)
+    {
+        return _mm512_cmpeq_epi8_mask(load(p), _mm512_set1_epi8('\n'));
+    }
+
+    static std::uint64_t spaces(const unsigned char *p)
+    {
+        auto v = load(p);
+
+        return _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8(' ')) |
+            in_range(v, '\t', '\r');
+    }
+
+    static std::uint64_t special(const unsigned char *p)
+    {
+        return in_range(load(p), '\xe1', '\xe3');
+    }
+
+    static std::uint64_t continuations(const unsigned char *p)
+    {
+        return _mm512_cmplt_epi8_mask(load(p), _mm512_set1_epi8(-64));
+    }
+};
+
+}
+
+const CountKernel avx512_kernel =
+    make_simd_kernel<Avx512>("avx512", std::make_index_sequence<CountKernel::VARIANTS>());
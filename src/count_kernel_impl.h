@@ -0,0 +1,463 @@
+// Copyright 2018 Kurt Kanzenbach <kurt@kmk-computers.de>
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef _COUNT_KERNEL_IMPL_H_
+#define _COUNT_KERNEL_IMPL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "count_kernel.h"
+#include "utf8.h"
+
+/**
+ * Building blocks of the counting kernels.
+ *
+ * This header is included by every kernel translation unit, which are
+ * compiled with different instruction set flags. Therefore, everything
+ * in here has internal linkage. Otherwise the linker might pick e.g. the
+ * AVX2 version of an inline function for the generic code.
+ */
+namespace {
+
+std::size_t scalar_lines(const unsigned char *p, const unsigned char *end)
+{
+    std::size_t lines = 0;
+
+    for (; p < end; ++p)
+        lines += *p == '\n';
+
+    return lines;
+}
+
+/**
+ * Counts the words of all characters starting before @stop. Returns the
+ * position after the last character, which may be beyond @stop if a
+ * multi byte whitespace sequence crosses it.
+ *
+ * Bytes which are not part of a multi byte whitespace sequence are
+ * classified on their own. For valid UTF-8 this is the same as
+ * classifying the whole characters, because only the sequences starting
+ * with 0xe1 - 0xe3 can be whitespace.
+ */
+const unsigned char *scalar_words(const unsigned char *p, const unsigned char *stop,
+                                  const unsigned char *end, bool& prev_space,
+                                  std::size_t& words)
+{
+    while (p < stop) {
+        bool space;
+
+        if (*p >= 0xe1 && *p <= 0xe3 && Utf8::is_space(p, end)) {
+            space = true;
+            p += 3;
+        } else
+            space = Utf8::is_ascii_space(*p++);
+
+        words += !space && prev_space;
+        prev_space = space;
+    }
+
+    return p;
+}
+
+std::size_t scalar_chars(const unsigned char *p, const unsigned char *end)
+{
+    std::size_t chars = 0;
+
+    for (; p < end; ++p)
+        chars += !Utf8::is_continuation(*p);
+
+    return chars;
+}
+
+/**
+ * Validates all sequences starting before @stop and counts the invalid
+ * ones. Returns the position after the last sequence.
+ */
+const unsigned char *scalar_validate(const unsigned char *p, const unsigned char *stop,
+                                     const unsigned char *end, std::size_t& invalid)
+{
+    while (p < stop) {
+        auto len = Utf8::sequence(p, end);
+
+        if (len < 0) {
+            invalid++;
+            len = -len;
+        }
+        p += len;
+    }
+
+    return p;
+}
+
+inline std::size_t popcount(std::uint64_t mask)
+{
+    return __builtin_popcountll(mask);
+}
+
+/**
+ * Validation for instruction sets without byte shuffles: Blocks which are
+ * pure ASCII are skipped, everything else is validated by the scalar
+ * code. @Simd::non_ascii(p) yields the mask of bytes >= 0x80.
+ */
+template<typename Simd>
+class AsciiValidator
+{
+public:
+    AsciiValidator(const unsigned char *data, const unsigned char *end) :
+        m_end{end}, m_next{data}, m_invalid{0}
+    {}
+
+    void block(const unsigned char *p)
+    {
+        if (m_next >= p + 64 || !Simd::non_ascii(p))
+            return;
+
+        m_next = scalar_validate(p > m_next ? p : m_next, p + 64, m_end, m_invalid);
+    }
+
+    std::size_t finish(const unsigned char *tail)
+    {
+        scalar_validate(tail > m_next ? tail : m_next, m_end, m_end, m_invalid);
+
+        return m_invalid;
+    }
+
+private:
+    const unsigned char *m_end;
+    const unsigned char *m_next;
+    std::size_t m_invalid;
+};
+
+#ifdef __AVX2__
+
+/**
+ * Validation by table lookups as described by Keiser and Lemire in
+ * "Validating UTF-8 In Less Than One Instruction Per Byte". Each byte is
+ * checked against the high and low nibble of its predecessor and the
+ * lengths of multi byte sequences are checked by looking back two and
+ * three bytes. The vectors only tell whether there is an error at all,
+ * so invalid loads are scanned once more to count the invalid sequences.
+ */
+class LookupValidator
+{
+public:
+    LookupValidator(const unsigned char *data, const unsigned char *end) :
+        m_data{data}, m_end{end},
+        m_prev{_mm256_setzero_si256()},
+        m_incomplete{_mm256_setzero_si256()},
+        m_error{_mm256_setzero_si256()}
+    {}
+
+    void block(const unsigned char *p)
+    {
+        check(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p)));
+        check(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 32)));
+    }
+
+    std::size_t finish(const unsigned char *tail)
+    {
+        alignas(32) unsigned char buf[64] = { 0 };
+        std::size_t invalid = 0;
+
+        // zero padding terminates incomplete sequences at the end
+        std::memcpy(buf, tail, m_end - tail);
+        block(buf);
+
+        if (_mm256_testz_si256(m_error, m_error))
+            return 0;
+
+        scalar_validate(m_data, m_end, m_end, invalid);
+
+        return invalid;
+    }
+
+private:
+    static constexpr std::uint8_t TOO_SHORT      = 1 << 0;
+    static constexpr std::uint8_t TOO_LONG       = 1 << 1;
+    static constexpr std::uint8_t OVERLONG_3     = 1 << 2;
+    static constexpr std::uint8_t TOO_LARGE      = 1 << 3;
+    static constexpr std::uint8_t SURROGATE      = 1 << 4;
+    static constexpr std::uint8_t OVERLONG_2     = 1 << 5;
+    static constexpr std::uint8_t TOO_LARGE_1000 = 1 << 6;
+    static constexpr std::uint8_t OVERLONG_4     = 1 << 6;
+    static constexpr std::uint8_t TWO_CONTS      = 1 << 7;
+    static constexpr std::uint8_t CARRY          = TOO_SHORT | TOO_LONG | TWO_CONTS;
+
+    static __m256i table(std::uint8_t t0, std::uint8_t t1, std::uint8_t t2, std::uint8_t t3,
+                         std::uint8_t t4, std::uint8_t t5, std::uint8_t t6, std::uint8_t t7,
+                         std::uint8_t t8, std::uint8_t t9, std::uint8_t t10, std::uint8_t t11,
+                         std::uint8_t t12, std::uint8_t t13, std::uint8_t t14, std::uint8_t t15)
+    {
+        return _mm256_setr_epi8(t0, t1, t2, t3, t4, t5, t6, t7, t8, t9, t10, t11, t12, t13, t14, t15,
+                                t0, t1, t2, t3, t4, t5, t6, t7, t8, t9, t10, t11, t12, t13, t14, t15);
+    }
+
+    static __m256i high_nibbles(__m256i v)
+    {
+        return _mm256_and_si256(_mm256_srli_epi16(v, 4), _mm256_set1_epi8(0x0f));
+    }
+
+    // input shifted by N bytes with the end of the previous vector shifted in
+    template<int N>
+    static __m256i prev(__m256i input, __m256i prev_input)
+    {
+        return _mm256_alignr_epi8(input, _mm256_permute2x128_si256(prev_input, input, 0x21),
+                                  16 - N);
+    }
+
+    static __m256i special_cases(__m256i input, __m256i prev1)
+    {
+        const auto byte_1_high = _mm256_shuffle_epi8(
+            table(TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+                  TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+                  TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+                  TOO_SHORT | OVERLONG_2,
+                  TOO_SHORT,
+                  TOO_SHORT | OVERLONG_3 | SURROGATE,
+                  TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4),
+            high_nibbles(prev1));
+        const auto byte_1_low = _mm256_shuffle_epi8(
+            table(CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+                  CARRY | OVERLONG_2,
+                  CARRY,
+                  CARRY,
+                  CARRY | TOO_LARGE,
+                  CARRY | TOO_LARGE | TOO_LARGE_1000,
+                  CARRY | TOO_LARGE | TOO_LARGE_1000,
+                  CARRY | TOO_LARGE | TOO_LARGE_1000,
+                  CARRY | TOO_LARGE | TOO_LARGE_1000,
+                  CARRY | TOO_LARGE | TOO_LARGE_1000,
+                  CARRY | TOO_LARGE | TOO_LARGE_1000,
+                  CARRY | TOO_LARGE | TOO_LARGE_1000,
+                  CARRY | TOO_LARGE | TOO_LARGE_1000,
+                  CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+                  CARRY | TOO_LARGE | TOO_LARGE_1000,
+                  CARRY | TOO_LARGE | TOO_LARGE_1000),
+            _mm256_and_si256(prev1, _mm256_set1_epi8(0x0f)));
+        const auto byte_2_high = _mm256_shuffle_epi8(
+            table(TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+                  TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+                  TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+                  TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+                  TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+                  TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+                  TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT),
+            high_nibbles(input));
+
+        return _mm256_and_si256(_mm256_and_si256(byte_1_high, byte_1_low), byte_2_high);
+    }
+
+    static __m256i multibyte_lengths(__m256i input, __m256i prev_input, __m256i special)
+    {
+        // only 111_____ resp. 1111____ end up >= 0x80
+        auto third = _mm256_subs_epu8(prev<2>(input, prev_input), _mm256_set1_epi8(0xe0 - 0x80));
+        auto fourth = _mm256_subs_epu8(prev<3>(input, prev_input), _mm256_set1_epi8(0xf0 - 0x80));
+        auto must23_80 = _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8(static_cast<char>(0x80)));
+
+        return _mm256_xor_si256(must23_80, special);
+    }
+
+    static __m256i incomplete(__m256i input)
+    {
+        // lead bytes in the last three positions which are cut off
+        const auto max = _mm256_setr_epi8(
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            static_cast<char>(0xf0 - 1), static_cast<char>(0xe0 - 1),
+            static_cast<char>(0xc0 - 1));
+
+        return _mm256_subs_epu8(input, max);
+    }
+
+    void check(__m256i input)
+    {
+        if (!_mm256_movemask_epi8(input)) {
+            // ASCII can only be wrong if the previous vector was cut off
+            m_error = _mm256_or_si256(m_error, m_incomplete);
+        } else {
+            auto special = special_cases(input, prev<1>(input, m_prev));
+
+            m_error = _mm256_or_si256(m_error, multibyte_lengths(input, m_prev, special));
+            m_incomplete = incomplete(input);
+        }
+        m_prev = input;
+    }
+
+    const unsigned char *m_data;
+    const unsigned char *m_end;
+    __m256i m_prev;
+    __m256i m_incomplete;
+    __m256i m_error;
+};
+
+#endif
+
+/**
+ * Counting without vector instructions. Lines only is the common case of
+ * log processing and gets a memchr() loop, which is vectorized by libc.
+ */
+template<std::uint32_t Metrics>
+void scalar_count(const unsigned char *data, std::size_t size, bool& prev_space,
+                  CountKernel::Counts& counts)
+{
+    constexpr bool lines = Metrics & CountKernel::LINES;
+    constexpr bool words = Metrics & CountKernel::WORDS;
+    constexpr bool chars = Metrics & CountKernel::CHARS;
+    constexpr bool validate = Metrics & CountKernel::VALIDATE;
+    const auto end = data + size;
+
+    if constexpr (Metrics == CountKernel::LINES) {
+        auto p = data;
+
+        while ((p = static_cast<const unsigned char *>(std::memchr(p, '\n', end - p)))) {
+            counts.lines++;
+            if (++p == end)
+                break;
+        }
+        return;
+    }
+
+    if constexpr (lines)
+        counts.lines += scalar_lines(data, end);
+    if constexpr (words)
+        scalar_words(data, end, end, prev_space, counts.words);
+    if constexpr (chars)
+        counts.chars += scalar_chars(data, end);
+    if constexpr (validate)
+        scalar_validate(data, end, end, counts.invalid);
+}
+
+/**
+ * Generic loops over blocks of 64 bytes. @Simd classifies a block into
+ * bit masks, one bit per byte:
+ *
+ *  - newlines(p): '\n'
+ *  - spaces(p):   ASCII whitespace
+ *  - special(p):  0xe1 - 0xe3, i.e. possible multi byte whitespace
+ *  - continuations(p): 0x80 - 0xbf
+ *
+ * @Simd::Validator checks the blocks for valid UTF-8.
+ *
+ * Blocks containing special bytes are rare and handed to the scalar
+ * code, which classifies them properly.
+ */
+template<typename Simd>
+std::size_t simd_lines(const unsigned char *data, const unsigned char *end)
+{
+    std::size_t lines = 0;
+    auto p = data;
+
+    for (; end - p >= 64; p += 64)
+        lines += popcount(Simd::newlines(p));
+
+    return lines + scalar_lines(p, end);
+}
+
+/**
+ * Counts the word starts of the block at @p. @next is the position up to
+ * which the scalar code has already classified the data. Returns the
+ * new one.
+ */
+template<typename Simd>
+const unsigned char *simd_words(const unsigned char *p, const unsigned char *next,
+                                const unsigned char *end, bool& prev_space,
+                                std::size_t& words)
+{
+    if (next > p || Simd::special(p))
+        return scalar_words(next > p ? next : p, p + 64, end, prev_space, words);
+
+    auto spaces = Simd::spaces(p);
+
+    words += popcount(~spaces & ((spaces << 1) | prev_space));
+    prev_space = spaces >> 63;
+
+    return p + 64;
+}
+
+template<typename Simd, std::uint32_t Metrics>
+void simd_count(const unsigned char *data, std::size_t size, bool& prev_space,
+                CountKernel::Counts& counts)
+{
+    constexpr bool lines = Metrics & CountKernel::LINES;
+    constexpr bool words = Metrics & CountKernel::WORDS;
+    constexpr bool chars = Metrics & CountKernel::CHARS;
+    constexpr bool validate = Metrics & CountKernel::VALIDATE;
+    const auto end = data + size;
+
+    if constexpr (!Metrics)
+        return;
+
+    if constexpr (Metrics == CountKernel::LINES) {
+        counts.lines += simd_lines<Simd>(data, end);
+        return;
+    }
+
+    typename Simd::Validator validator{data, end};
+    auto words_next = data;
+    std::size_t conts = 0;
+    auto p = data;
+
+    for (; end - p >= 64; p += 64) {
+        if constexpr (lines)
+            counts.lines += popcount(Simd::newlines(p));
+        if constexpr (words)
+            words_next = simd_words<Simd>(p, words_next, end, prev_space, counts.words);
+        if constexpr (chars)
+            conts += popcount(Simd::continuations(p));
+        if constexpr (validate)
+            validator.block(p);
+    }
+
+    if constexpr (lines)
+        counts.lines += scalar_lines(p, end);
+    if constexpr (words)
+        scalar_words(p > words_next ? p : words_next, end, end, prev_space, counts.words);
+    if constexpr (chars)
+        counts.chars += (p - data) - conts + scalar_chars(p, end);
+    if constexpr (validate)
+        counts.invalid += validator.finish(p);
+}
+
+template<std::size_t... Metrics>
+constexpr CountKernel make_scalar_kernel(std::index_sequence<Metrics...>)
+{
+    return { "scalar", { scalar_count<Metrics>... } };
+}
+
+template<typename Simd, std::size_t... Metrics>
+constexpr CountKernel make_simd_kernel(const char *name, std::index_sequence<Metrics...>)
+{
+    return { name, { simd_count<Simd, Metrics>... } };
+}
+
+}
+
+#endif /* _COUNT_KERNEL_IMPL_H_ */
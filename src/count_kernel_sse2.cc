@@ -0,0 +1,97 @@
+// Copyright 2018 Kurt Kanzenbach <kurt@kmk-computers.de>
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <emmintrin.h>
+
+#include "count_kernel.h"
+#include "count_kernel_impl.h"
+
+namespace {
+
+struct Sse2 {
+    using Validator = AsciiValidator<Sse2>;
+
+    template<typename Cmp>
+    static std::uint64_t mask(const unsigned char *p, Cmp cmp)
+    {
+        std::uint64_t mask = 0;
+
+        for (int i = 0; i < 4; ++i) {
+            auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 16 * i));
+            mask |= static_cast<std::uint64_t>(
+                static_cast<std::uint16_t>(_mm_movemask_epi8(cmp(v)))) << (16 * i);
+        }
+
+        return mask;
+    }
+
+    // unsigned lo <= v <= hi
+    static __m128i in_range(__m128i v, char lo, char hi)
+    {
+        auto t = _mm_sub_epi8(v, _mm_set1_epi8(lo));
+
+        return _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(hi - lo)), t);
+    }
+
+    static std::uint64_t newlines(const unsigned char *p)
+    {
+        return mask(p, [] (__m128i v) {
+                           return _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'));
+                       });
+    }
+
+    static std::uint64_t spaces(const unsigned char *p)
+    {
+        return mask(p, [] (__m128i v) {
+                           return _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                                               in_range(v, '\t', '\r'));
+                       });
+    }
+
+    static std::uint64_t special(const unsigned char *p)
+    {
+        return mask(p, [] (__m128i v) {
+                           return in_range(v, '\xe1', '\xe3');
+                       });
+    }
+
+    static std::uint64_t continuations(const unsigned char *p)
+    {
+        return mask(p, [] (__m128i v) {
+                           return _mm_cmplt_epi8(v, _mm_set1_epi8(-64));
+                       });
+    }
+
+    static std::uint64_t non_ascii(const unsigned char *p)
+    {
+        return mask(p, [] (__m128i v) {
+                           return v;
+                       });
+    }
+};
+
+}
+
+const CountKernel sse2_kernel =
+    make_simd_kernel<Sse2>("sse2", std::make_index_sequence<CountKernel::VARIANTS>());
@@ -0,0 +1,427 @@
+// Copyright 2018 Kurt Kanzenbach <kurt@kmk-computers.de>
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef _DECOMPRESSOR_H_
+#define _DECOMPRESSOR_H_
+
+#include "kwcng_config.h"
+
+#include <memory>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+
+#ifdef KWCNG_ZLIB
+#include <zlib.h>
+#endif
+#ifdef KWCNG_ZSTD
+#include <zstd.h>
+#endif
+
+/**
+ * Streaming decompression of gzip and zstd input, which is detected by
+ * its magic bytes.
+ *
+ * A decompressor continues with the next gzip member or zstd frame on
+ * its own, so concatenated files are decompressed as a whole. Formats
+ * whose library wasn't found at build time are reported as unsupported.
+ *
+ * A decompressor must only be used by one thread.
+ */
+class Decompressor
+{
+public:
+    enum class Format {
+        NONE,
+        GZIP,
+        ZSTD,
+    };
+
+    /**
+     * Independently decompressible part of a file, whose decompressed
+     * size is known up front.
+     */
+    struct Unit {
+        std::size_t offset;
+        std::size_t size;
+        std::size_t out_size;
+    };
+
+    static constexpr std::size_t MAGIC_SIZE = 4;
+
+    virtual ~Decompressor() = default;
+
+    static Format detect(const unsigned char *data, std::size_t size) noexcept
+    {
+        if (size >= 2 && data[0] == 0x1f && data[1] == 0x8b)
+            return Format::GZIP;
+        if (size >= 4 && data[0] == 0x28 && data[1] == 0xb5 && data[2] == 0x2f &&
+            data[3] == 0xfd)
+            return Format::ZSTD;
+
+        return Format::NONE;
+    }
+
+    static bool supported(Format format) noexcept
+    {
+        switch (format) {
+#ifdef KWCNG_ZLIB
+        case Format::GZIP:
+            return true;
+#endif
+#ifdef KWCNG_ZSTD
+        case Format::ZSTD:
+            return true;
+#endif
+        default:
+            return false;
+        }
+    }
+
+    /**
+     * Returns a nullptr if @format isn't supported.
+     */
+    static std::unique_ptr<Decompressor> create(Format format);
+
+    /**
+     * Splits @data into units, which can be decompressed in parallel.
+     * That's possible for zstd frames which record their size and for
+     * BGZF files, whose gzip members record their compressed size.
+     * Returns nothing if the file cannot be split this way.
+     */
+    static std::vector<Unit> units(Format format, const unsigned char *data, std::size_t size);
+
+    /**
+     * Decompresses the unit @in into @out, which has exactly the unit's
+     * decompressed size.
+     */
+    static bool decompress_unit(Format format, const unsigned char *in, std::size_t in_size,
+                                unsigned char *out, std::size_t out_size);
+
+    /**
+     * Decompresses as much of @in into @out as possible and advances
+     * both. Returns false if the input is corrupt.
+     */
+    virtual bool decompress(const unsigned char *& in, std::size_t& in_size,
+                            unsigned char *& out, std::size_t& out_size) = 0;
+
+    /**
+     * Whether the input consumed so far ends with a complete member or
+     * frame. Truncated input doesn't.
+     */
+    virtual bool complete() const noexcept = 0;
+};
+
+#ifdef KWCNG_ZLIB
+class GzipDecompressor : public Decompressor
+{
+public:
+    GzipDecompressor(const GzipDecompressor& other) = delete;
+    GzipDecompressor& operator=(const GzipDecompressor& other) = delete;
+
+    ~GzipDecompressor() override
+    {
+        ::inflateEnd(&m_stream);
+    }
+
+    static std::unique_ptr<GzipDecompressor> create()
+    {
+        std::unique_ptr<GzipDecompressor> decompressor{new GzipDecompressor};
+
+        if (::inflateInit2(&decompressor->m_stream, MAX_WBITS + 16) != Z_OK)
+            return nullptr;
+
+        return decompressor;
+    }
+
+    bool decompress(const unsigned char *& in, std::size_t& in_size,
+                    unsigned char *& out, std::size_t& out_size) override
+    {
+        if (!in_size && m_complete)
+            return true;
+
+        if (m_complete) {
+            // like gzip, trailing garbage such as tar padding is ignored
+            if (in[0] != 0x1f) {
+                in += in_size;
+                in_size = 0;
+                return true;
+            }
+            if (::inflateReset(&m_stream) != Z_OK)
+                return false;
+            m_complete = false;
+        }
+
+        const uInt avail_in = std::min<std::size_t>(in_size, std::numeric_limits<uInt>::max());
+        const uInt avail_out = std::min<std::size_t>(out_size, std::numeric_limits<uInt>::max());
+
+        m_stream.next_in = const_cast<Bytef *>(in);
+        m_stream.avail_in = avail_in;
+        m_stream.next_out = out;
+        m_stream.avail_out = avail_out;
+
+        auto ret = ::inflate(&m_stream, Z_NO_FLUSH);
+
+        in += avail_in - m_stream.avail_in;
+        in_size -= avail_in - m_stream.avail_in;
+        out += avail_out - m_stream.avail_out;
+        out_size -= avail_out - m_stream.avail_out;
+
+        if (ret == Z_STREAM_END) {
+            m_complete = true;
+            m_members++;
+        }
+
+        return ret == Z_OK || ret == Z_STREAM_END || ret == Z_BUF_ERROR;
+    }
+
+    bool complete() const noexcept override
+    {
+        return m_complete && m_members;
+    }
+
+    /**
+     * BGZF members carry their size in a "BC" extra field.
+     */
+    static std::vector<Unit> units(const unsigned char *data, std::size_t size)
+    {
+        std::vector<Unit> units;
+
+        for (std::size_t offset = 0; offset < size; ) {
+            const auto member = data + offset;
+            const auto left = size - offset;
+
+            if (left < 18 || member[0] != 0x1f || member[1] != 0x8b || member[2] != 8 ||
+                !(member[3] & 0x04))
+                return {};
+
+            const std::size_t xlen = member[10] | member[11] << 8;
+            std::size_t block = 0;
+
+            for (std::size_t field = 12; field + 4 <= 12 + xlen && field + 4 <= left; ) {
+                const std::size_t len = member[field + 2] | member[field + 3] << 8;
+
+                if (member[field] == 'B' && member[field + 1] == 'C' && len == 2 &&
+                    field + 6 <= left) {
+                    block = (member[field + 4] | member[field + 5] << 8) + 1;
+                    break;
+                }
+                field += 4 + len;
+            }
+
+            if (block < 18 + xlen || block > left)
+                return {};
+
+            const auto isize = member + block - 4;
+
+            units.push_back({offset, block,
+                             static_cast<std::size_t>(isize[0]) | isize[1] << 8 |
+                             isize[2] << 16 | static_cast<std::size_t>(isize[3]) << 24});
+            offset += block;
+        }
+
+        return units;
+    }
+
+    static bool decompress_unit(const unsigned char *in, std::size_t in_size,
+                                unsigned char *out, std::size_t out_size)
+    {
+        z_stream stream{};
+
+        if (in_size > std::numeric_limits<uInt>::max() ||
+            out_size > std::numeric_limits<uInt>::max() ||
+            ::inflateInit2(&stream, MAX_WBITS + 16) != Z_OK)
+            return false;
+
+        stream.next_in = const_cast<Bytef *>(in);
+        stream.avail_in = in_size;
+        stream.next_out = out;
+        stream.avail_out = out_size;
+
+        auto ret = ::inflate(&stream, Z_FINISH);
+        auto done = ret == Z_STREAM_END && stream.total_out == out_size;
+
+        ::inflateEnd(&stream);
+
+        return done;
+    }
+
+private:
+    GzipDecompressor() :
+        m_stream{}, m_complete{false}, m_members{0}
+    {}
+
+    z_stream m_stream;
+    bool m_complete;
+    std::size_t m_members;
+};
+#endif
+
+#ifdef KWCNG_ZSTD
+class ZstdDecompressor : public Decompressor
+{
+public:
+    ZstdDecompressor(const ZstdDecompressor& other) = delete;
+    ZstdDecompressor& operator=(const ZstdDecompressor& other) = delete;
+
+    ~ZstdDecompressor() override
+    {
+        ::ZSTD_freeDCtx(m_ctx);
+    }
+
+    static std::unique_ptr<ZstdDecompressor> create()
+    {
+        auto ctx = ::ZSTD_createDCtx();
+
+        if (!ctx)
+            return nullptr;
+
+        return std::unique_ptr<ZstdDecompressor>{new ZstdDecompressor(ctx)};
+    }
+
+    bool decompress(const unsigned char *& in, std::size_t& in_size,
+                    unsigned char *& out, std::size_t& out_size) override
+    {
+        ZSTD_inBuffer input{in, in_size, 0};
+        ZSTD_outBuffer output{out, out_size, 0};
+
+        auto ret = ::ZSTD_decompressStream(m_ctx, &output, &input);
+        if (::ZSTD_isError(ret))
+            return false;
+
+        in += input.pos;
+        in_size -= input.pos;
+        out += output.pos;
+        out_size -= output.pos;
+
+        // called without input after a frame, it waits for the next one
+        if (input.pos || output.pos)
+            m_complete = !ret;
+
+        return true;
+    }
+
+    bool complete() const noexcept override
+    {
+        return m_complete;
+    }
+
+    static std::vector<Unit> units(const unsigned char *data, std::size_t size)
+    {
+        std::vector<Unit> units;
+
+        for (std::size_t offset = 0; offset < size; ) {
+            auto frame = ::ZSTD_findFrameCompressedSize(data + offset, size - offset);
+            auto content = ::ZSTD_getFrameContentSize(data + offset, size - offset);
+
+            if (::ZSTD_isError(frame) || content == ZSTD_CONTENTSIZE_UNKNOWN ||
+                content == ZSTD_CONTENTSIZE_ERROR)
+                return {};
+
+            units.push_back({offset, frame, static_cast<std::size_t>(content)});
+            offset += frame;
+        }
+
+        return units;
+    }
+
+    static bool decompress_unit(const unsigned char *in, std::size_t in_size,
+                                unsigned char *out, std::size_t out_size)
+    {
+        auto ret = ::ZSTD_decompress(out, out_size, in, in_size);
+
+        return !::ZSTD_isError(ret) && ret == out_size;
+    }
+
+private:
+    explicit ZstdDecompressor(ZSTD_DCtx *ctx) :
+        m_ctx{ctx}, m_complete{false}
+    {}
+
+    ZSTD_DCtx *m_ctx;
+    bool m_complete;
+};
+#endif
+
+inline std::unique_ptr<Decompressor> Decompressor::create(Format format)
+{
+    switch (format) {
+#ifdef KWCNG_ZLIB
+    case Format::GZIP:
+        return GzipDecompressor::create();
+#endif
+#ifdef KWCNG_ZSTD
+    case Format::ZSTD:
+        return ZstdDecompressor::create();
+#endif
+    default:
+        return nullptr;
+    }
+}
+
+inline std::vector<Decompressor::Unit> Decompressor::units(
+    Format format, const unsigned char *data, std::size_t size)
+{
+    switch (format) {
+#ifdef KWCNG_ZLIB
+    case Format::GZIP:
+        return GzipDecompressor::units(data, size);
+#endif
+#ifdef KWCNG_ZSTD
+    case Format::ZSTD:
+        return ZstdDecompressor::units(data, size);
+#endif
+    default:
+        (void)data;
+        (void)size;
+        return {};
+    }
+}
+
+inline bool Decompressor::decompress_unit(Format format, const unsigned char *in,
+                                          std::size_t in_size, unsigned char *out,
+                                          std::size_t out_size)
+{
+    switch (format) {
+#ifdef KWCNG_ZLIB
+    case Format::GZIP:
+        return GzipDecompressor::decompress_unit(in, in_size, out, out_size);
+#endif
+#ifdef KWCNG_ZSTD
+    case Format::ZSTD:
+        return ZstdDecompressor::decompress_unit(in, in_size, out, out_size);
+#endif
+    default:
+        (void)in;
+        (void)in_size;
+        (void)out;
+        (void)out_size;
+        return false;
+    }
+}
+
+#endif /* _DECOMPRESSOR_H_ */
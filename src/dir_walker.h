@@ -0,0 +1,225 @@
+// Copyright 2018 Kurt Kanzenbach <kurt@kmk-computers.de>
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef _DIR_WALKER_H_
+#define _DIR_WALKER_H_
+
+#include <mutex>
+#include <deque>
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <condition_variable>
+
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include "file_table.h"
+
+/**
+ * Walks directory trees with several threads and adds the regular files
+ * to the file table as soon as they're found, so the readers start
+ * before the walk is done.
+ *
+ * Directories are queued by path and opened when they're listed, which
+ * keeps the number of open descriptors bounded. The entry type from the
+ * directory listing is used where available, only unknown types cost an
+ * fstatat(). Symbolic links are not followed. The table is closed once
+ * the last directory has been listed.
+ */
+class DirWalker
+{
+public:
+    using Error = std::pair<std::string, int>;
+
+    explicit DirWalker(FileTable& files) :
+        m_files{files}, m_pending{0}
+    {}
+
+    void add(const std::string& dir)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        m_dirs.push_back(dir);
+        m_pending++;
+        m_cv.notify_one();
+    }
+
+    /**
+     * Body of the walker threads.
+     */
+    void walk()
+    {
+        while (42) {
+            std::string dir;
+
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+
+                // zZz
+                m_cv.wait(lock, [&] { return !m_dirs.empty() || !m_pending; });
+                if (m_dirs.empty())
+                    return;
+
+                dir = std::move(m_dirs.front());
+                m_dirs.pop_front();
+            }
+
+            list(dir);
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!--m_pending) {
+                m_files.close();
+                m_cv.notify_all();
+            }
+        }
+    }
+
+    /**
+     * Directories which could not be listed. Only valid after the walk.
+     */
+    const std::vector<Error>& errors() const noexcept
+    {
+        return m_errors;
+    }
+
+    /**
+     * Forgets the errors of the last walk.
+     */
+    void reset()
+    {
+        m_errors.clear();
+    }
+
+private:
+    void list(const std::string& dir)
+    {
+        int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        auto prefix = dir.back() == '/' ? dir : dir + "/";
+
+        if (fd < 0) {
+            error(dir, errno);
+            return;
+        }
+
+        auto ret = for_each_entry(fd, [&] (const char *name, unsigned char type) {
+            if (!std::strcmp(name, ".") || !std::strcmp(name, ".."))
+                return;
+
+            if (type == DT_UNKNOWN) {
+                struct stat st;
+
+                if (::fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW))
+                    return;
+                type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+            }
+
+            if (type == DT_DIR)
+                add(prefix + name);
+            else if (type == DT_REG)
+                m_files.add(prefix + name);
+        });
+        if (ret)
+            error(dir, ret);
+
+        ::close(fd);
+    }
+
+    template<typename F>
+    static int for_each_entry(int fd, F&& f)
+    {
+#ifdef __linux__
+        // header of struct linux_dirent64, the name follows the type
+        struct Dirent64 {
+            std::uint64_t d_ino;
+            std::int64_t d_off;
+            unsigned short d_reclen;
+            unsigned char d_type;
+        };
+        alignas(Dirent64) char buffer[64 * 1024];
+
+        while (42) {
+            auto ret = ::syscall(SYS_getdents64, fd, buffer, sizeof(buffer));
+
+            if (ret < 0 && errno == EINTR)
+                continue;
+            if (ret < 0)
+                return errno;
+            if (!ret)
+                return 0;
+
+            for (long pos = 0; pos < ret; ) {
+                auto entry = reinterpret_cast<const Dirent64 *>(buffer + pos);
+
+                f(reinterpret_cast<const char *>(&entry->d_type) + 1, entry->d_type);
+                pos += entry->d_reclen;
+            }
+        }
+#else
+        auto dup = ::dup(fd);
+        auto dir = dup < 0 ? nullptr : ::fdopendir(dup);
+        struct dirent *entry;
+
+        if (!dir) {
+            if (dup >= 0)
+                ::close(dup);
+            return errno;
+        }
+
+        errno = 0;
+        while ((entry = ::readdir(dir)))
+            f(entry->d_name, entry->d_type);
+        auto ret = errno;
+        ::closedir(dir);
+
+        return ret;
+#endif
+    }
+
+    void error(const std::string& dir, int err)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        m_errors.emplace_back(dir, err);
+    }
+
+    FileTable& m_files;
+    std::deque<std::string> m_dirs;
+    std::vector<Error> m_errors;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::size_t m_pending;
+};
+
+#endif /* _DIR_WALKER_H_ */
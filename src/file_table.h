@@ -0,0 +1,180 @@
+// Copyright 2018 Kurt Kanzenbach <kurt@kmk-computers.de>
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef _FILE_TABLE_H_
+#define _FILE_TABLE_H_
+
+#include <mutex>
+#include <deque>
+#include <string>
+#include <cstddef>
+#include <condition_variable>
+
+using FileId = std::size_t;
+
+/**
+ * Assigns dense ids to the input files.
+ *
+ * Loads and results only carry the id. The name is looked up when the
+ * results are printed. Every file added gets an id of its own, so a file
+ * named twice is counted and printed twice, its counts add up in the
+ * totals.
+ *
+ * Files may be added while the readers are already running, e.g. by the
+ * directory walkers. The readers claim the files in order of their ids
+ * until the table has been closed. Entries never move, so references
+ * stay valid. The error codes and the number of bytes read are only
+ * written by the reader owning the file.
+ */
+class FileTable
+{
+public:
+    FileTable() :
+        m_claimed{0}, m_closed{false}
+    {}
+
+    FileId add(const std::string& name)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto id = m_entries.size();
+
+        m_entries.push_back({name, 0, 0, 0});
+        m_cv.notify_one();
+
+        return id;
+    }
+
+    /**
+     * Forgets all files, so that the table can be used for another run.
+     */
+    void reset()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        m_entries.clear();
+        m_claimed = 0;
+        m_closed = false;
+    }
+
+    /**
+     * No more files are going to be added.
+     */
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        m_closed = true;
+        m_cv.notify_all();
+    }
+
+    /**
+     * Hands out the next file to a reader. Returns false if all files
+     * have been claimed and the table is closed.
+     */
+    bool claim(FileId& id)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        // zZz
+        m_cv.wait(lock, [&] { return m_claimed < m_entries.size() || m_closed; });
+        if (m_claimed == m_entries.size())
+            return false;
+
+        id = m_claimed++;
+        return true;
+    }
+
+    const std::string& name(FileId id) const
+    {
+        return entry(id).name;
+    }
+
+    int& open_error(FileId id)
+    {
+        return entry(id).open_error;
+    }
+
+    const int& open_error(FileId id) const
+    {
+        return entry(id).open_error;
+    }
+
+    int& read_error(FileId id)
+    {
+        return entry(id).read_error;
+    }
+
+    const int& read_error(FileId id) const
+    {
+        return entry(id).read_error;
+    }
+
+    std::size_t& bytes(FileId id)
+    {
+        return entry(id).bytes;
+    }
+
+    const std::size_t& bytes(FileId id) const
+    {
+        return entry(id).bytes;
+    }
+
+    std::size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        return m_entries.size();
+    }
+
+private:
+    struct Entry {
+        std::string name;
+        int open_error;
+        int read_error;
+        std::size_t bytes;
+    };
+
+    Entry& entry(FileId id)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        return m_entries[id];
+    }
+
+    const Entry& entry(FileId id) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        return m_entries[id];
+    }
+
+    std::deque<Entry> m_entries;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::size_t m_claimed;
+    bool m_closed;
+};
+
+#endif /* _FILE_TABLE_H_ */
@@ -0,0 +1,124 @@
+// Copyright 2018 Kurt Kanzenbach <kurt@kmk-computers.de>
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef _FILE_WATCH_H_
+#define _FILE_WATCH_H_
+
+#include <string>
+#include <chrono>
+#include <thread>
+#include <cerrno>
+
+#include "kwcng_config.h"
+
+#ifdef KWCNG_INOTIFY
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#endif
+
+/**
+ * Waits for changes of the files in a set of directories.
+ *
+ * Watching the directories instead of the files themselves also catches
+ * files being rotated or created. Without inotify every wait simply
+ * times out and reports a change, so the files are polled.
+ */
+class FileWatch
+{
+public:
+    FileWatch() :
+        m_fd{-1}, m_polling{true}
+    {
+#ifdef KWCNG_INOTIFY
+        m_fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        m_polling = m_fd < 0;
+#endif
+    }
+
+    FileWatch(const FileWatch& other) = delete;
+    FileWatch& operator=(const FileWatch& other) = delete;
+
+    ~FileWatch()
+    {
+#ifdef KWCNG_INOTIFY
+        if (m_fd >= 0)
+            ::close(m_fd);
+#endif
+    }
+
+    /**
+     * Returns false if the directory cannot be watched, the caller has to
+     * poll then.
+     */
+    bool add(const std::string& dir)
+    {
+#ifdef KWCNG_INOTIFY
+        if (m_fd >= 0 &&
+            ::inotify_add_watch(m_fd, dir.c_str(), IN_MODIFY | IN_CREATE | IN_DELETE |
+                                IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB) >= 0)
+            return true;
+#else
+        (void)dir;
+#endif
+        m_polling = true;
+        return false;
+    }
+
+    /**
+     * Waits up to @timeout for a change. Returns whether something may
+     * have changed.
+     */
+    bool wait(std::chrono::milliseconds timeout)
+    {
+#ifdef KWCNG_INOTIFY
+        if (!m_polling) {
+            struct pollfd pfd = { m_fd, POLLIN, 0 };
+            char buffer[4096];
+            auto changed = false;
+
+            // zZz
+            if (::poll(&pfd, 1, timeout.count()) <= 0)
+                return false;
+
+            // the events themselves don't matter, the files are checked anyway
+            while (::read(m_fd, buffer, sizeof(buffer)) > 0)
+                changed = true;
+
+            return changed;
+        }
+#endif
+        // zZz
+        std::this_thread::sleep_for(timeout);
+
+        return true;
+    }
+
+private:
+    int m_fd;
+    bool m_polling;
+};
+
+#endif /* _FILE_WATCH_H_ */
@@ -0,0 +1,102 @@
+// Copyright 2018 Kurt Kanzenbach <kurt@kmk-computers.de>
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef _INFLIGHT_LIMIT_H_
+#define _INFLIGHT_LIMIT_H_
+
+#include <mutex>
+#include <atomic>
+#include <cstddef>
+#include <condition_variable>
+
+/**
+ * Caps the number of bytes which are queued or being counted.
+ *
+ * Readers acquire the size of a load before queuing it, the counting
+ * threads release it once they're done. A load is always admitted if
+ * nothing is in flight, so loads larger than the limit still make
+ * progress. A limit of zero disables the check.
+ */
+class InflightLimit
+{
+public:
+    explicit InflightLimit(std::size_t limit) :
+        m_limit{limit}, m_inflight{0}, m_waiters{0}
+    {}
+
+    void acquire(std::size_t bytes)
+    {
+        if (!m_limit) {
+            m_inflight.fetch_add(bytes);
+            return;
+        }
+
+        if (try_acquire(bytes))
+            return;
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        m_waiters++;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        m_cv.wait(lock, [&] { return try_acquire(bytes); });
+        m_waiters--;
+    }
+
+    void release(std::size_t bytes)
+    {
+        m_inflight.fetch_sub(bytes);
+
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!m_waiters.load(std::memory_order_relaxed))
+            return;
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_cv.notify_all();
+    }
+
+    std::size_t inflight() const noexcept
+    {
+        return m_inflight.load(std::memory_order_relaxed);
+    }
+
+private:
+    bool try_acquire(std::size_t bytes)
+    {
+        auto cur = m_inflight.load();
+
+        while (!cur || cur + bytes <= m_limit)
+            if (m_inflight.compare_exchange_weak(cur, cur + bytes))
+                return true;
+
+        return false;
+    }
+
+    const std::size_t m_limit;
+    std::atomic<std::size_t> m_inflight;
+    std::atomic<std::size_t> m_waiters;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+};
+
+#endif /* _INFLIGHT_LIMIT_H_ */
@@ -0,0 +1,297 @@
+// Copyright 2018 Kurt Kanzenbach <kurt@kmk-computers.de>
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef _IO_RING_H_
+#define _IO_RING_H_
+
+#include "kwcng_config.h"
+
+#ifdef KWCNG_IO_URING
+
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/**
+ * Minimal io_uring instance for reading files. It talks to the kernel
+ * directly, so there is no dependency on liburing.
+ *
+ * Buffers can be registered in a sparse table, which saves the kernel
+ * from pinning them for every single read. That's optional: If the
+ * kernel or the memlock limit doesn't allow it, plain reads are used.
+ *
+ * A ring must only be used by one thread.
+ */
+class IoRing
+{
+public:
+    struct Completion {
+        std::uint64_t tag;
+        int res;
+    };
+
+    IoRing(const IoRing& other) = delete;
+    IoRing& operator=(const IoRing& other) = delete;
+
+    ~IoRing()
+    {
+        if (m_sqes)
+            ::munmap(m_sqes, m_sqes_size);
+        if (m_cq && m_cq != m_sq)
+            ::munmap(m_cq, m_cq_size);
+        if (m_sq)
+            ::munmap(m_sq, m_sq_size);
+        ::close(m_fd);
+    }
+
+    /**
+     * Sets up a ring with @entries submission entries and room for
+     * @buffers registered buffers. Returns a nullptr if io_uring isn't
+     * available.
+     */
+    static std::unique_ptr<IoRing> create(unsigned entries, unsigned buffers)
+    {
+        io_uring_params params;
+
+        std::memset(&params, 0, sizeof(params));
+        int fd = ::syscall(__NR_io_uring_setup, entries, &params);
+        if (fd < 0)
+            return nullptr;
+
+        std::unique_ptr<IoRing> ring{new IoRing(fd)};
+        if (!ring->map(params))
+            return nullptr;
+        ring->register_table(buffers);
+
+        return ring;
+    }
+
+    /**
+     * Registers @buffer as @index of the buffer table. Returns false if
+     * the buffer cannot be used for fixed reads.
+     */
+    bool register_buffer(std::size_t index, void *buffer, std::size_t size)
+    {
+        if (index >= m_registered.size())
+            return false;
+        if (m_registered[index])
+            return true;
+
+#ifdef IORING_RSRC_REGISTER_SPARSE
+        io_uring_rsrc_update2 update;
+        iovec iov{buffer, size};
+
+        std::memset(&update, 0, sizeof(update));
+        update.offset = index;
+        update.data = reinterpret_cast<std::uintptr_t>(&iov);
+        update.nr = 1;
+
+        if (::syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_BUFFERS_UPDATE,
+                      &update, sizeof(update)) < 0) {
+            // most likely the memlock limit, don't try again
+            m_registered.clear();
+            return false;
+        }
+
+        m_registered[index] = true;
+        return true;
+#else
+        (void)buffer;
+        (void)size;
+        return false;
+#endif
+    }
+
+    /**
+     * Queues a read of @len bytes at @offset of @fd. A @buffer_index of
+     * -1 means that the buffer isn't registered. Returns false if the
+     * submission queue is full.
+     */
+    bool read(int fd, void *buffer, unsigned len, std::uint64_t offset,
+              std::uint64_t tag, int buffer_index = -1)
+    {
+        auto tail = *m_sq_tail;
+        auto head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+
+        if (tail - head == m_sq_entries)
+            return false;
+
+        auto index = tail & m_sq_mask;
+        auto sqe = &m_sqes[index];
+
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = buffer_index < 0 ? IORING_OP_READ : IORING_OP_READ_FIXED;
+        sqe->fd = fd;
+        sqe->addr = reinterpret_cast<std::uintptr_t>(buffer);
+        sqe->len = len;
+        sqe->off = offset;
+        sqe->user_data = tag;
+        sqe->buf_index = buffer_index < 0 ? 0 : buffer_index;
+        m_sq_array[index] = index;
+
+        __atomic_store_n(m_sq_tail, tail + 1, __ATOMIC_RELEASE);
+        m_unsubmitted++;
+
+        return true;
+    }
+
+    /**
+     * Submits the queued reads and waits for at least @wait completions.
+     * Returns zero or a negative error code.
+     */
+    int submit(unsigned wait)
+    {
+        while (42) {
+            auto ret = ::syscall(__NR_io_uring_enter, m_fd, m_unsubmitted, wait,
+                                 wait ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+
+            if (ret >= 0) {
+                m_unsubmitted -= ret;
+                return 0;
+            }
+            if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+                return -errno;
+        }
+    }
+
+    bool reap(Completion& completion)
+    {
+        auto head = *m_cq_head;
+
+        if (head == __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE))
+            return false;
+
+        auto cqe = &m_cqes[head & m_cq_mask];
+        completion.tag = cqe->user_data;
+        completion.res = cqe->res;
+
+        __atomic_store_n(m_cq_head, head + 1, __ATOMIC_RELEASE);
+
+        return true;
+    }
+
+private:
+    explicit IoRing(int fd) :
+        m_fd{fd}, m_sq{nullptr}, m_cq{nullptr}, m_sqes{nullptr},
+        m_sq_size{0}, m_cq_size{0}, m_sqes_size{0}, m_unsubmitted{0}
+    {}
+
+    static void *map_ring(int fd, std::size_t size, off_t offset)
+    {
+        auto ptr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          fd, offset);
+
+        return ptr == MAP_FAILED ? nullptr : ptr;
+    }
+
+    template<typename T>
+    static T *at(void *base, std::uint32_t offset)
+    {
+        return reinterpret_cast<T *>(static_cast<char *>(base) + offset);
+    }
+
+    bool map(const io_uring_params& params)
+    {
+        m_sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        m_cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+
+        if (params.features & IORING_FEAT_SINGLE_MMAP)
+            m_sq_size = m_cq_size = std::max(m_sq_size, m_cq_size);
+
+        m_sq = map_ring(m_fd, m_sq_size, IORING_OFF_SQ_RING);
+        if (!m_sq)
+            return false;
+        m_cq = params.features & IORING_FEAT_SINGLE_MMAP ?
+            m_sq : map_ring(m_fd, m_cq_size, IORING_OFF_CQ_RING);
+        if (!m_cq)
+            return false;
+        m_sqes = static_cast<io_uring_sqe *>(map_ring(m_fd, m_sqes_size, IORING_OFF_SQES));
+        if (!m_sqes)
+            return false;
+
+        m_sq_head    = at<unsigned>(m_sq, params.sq_off.head);
+        m_sq_tail    = at<unsigned>(m_sq, params.sq_off.tail);
+        m_sq_array   = at<unsigned>(m_sq, params.sq_off.array);
+        m_sq_mask    = *at<unsigned>(m_sq, params.sq_off.ring_mask);
+        m_sq_entries = params.sq_entries;
+        m_cq_head    = at<unsigned>(m_cq, params.cq_off.head);
+        m_cq_tail    = at<unsigned>(m_cq, params.cq_off.tail);
+        m_cqes       = at<io_uring_cqe>(m_cq, params.cq_off.cqes);
+        m_cq_mask    = *at<unsigned>(m_cq, params.cq_off.ring_mask);
+
+        return true;
+    }
+
+    void register_table(unsigned buffers)
+    {
+#ifdef IORING_RSRC_REGISTER_SPARSE
+        io_uring_rsrc_register reg;
+
+        std::memset(&reg, 0, sizeof(reg));
+        reg.nr = buffers;
+        reg.flags = IORING_RSRC_REGISTER_SPARSE;
+
+        if (::syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_BUFFERS2,
+                      &reg, sizeof(reg)) == 0)
+            m_registered.assign(buffers, false);
+#else
+        (void)buffers;
+#endif
+    }
+
+    int m_fd;
+    void *m_sq;
+    void *m_cq;
+    io_uring_sqe *m_sqes;
+    std::size_t m_sq_size;
+    std::size_t m_cq_size;
+    std::size_t m_sqes_size;
+    unsigned *m_sq_head;
+    unsigned *m_sq_tail;
+    unsigned *m_sq_array;
+    unsigned m_sq_mask;
+    unsigned m_sq_entries;
+    unsigned *m_cq_head;
+    unsigned *m_cq_tail;
+    io_uring_cqe *m_cqes;
+    unsigned m_cq_mask;
+    unsigned m_unsubmitted;
+    std::vector<bool> m_registered;
+};
+
+#endif /* KWCNG_IO_URING */
+
+#endif /* _IO_RING_H_ */
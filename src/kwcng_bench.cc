@@ -0,0 +1,408 @@
+// Copyright 2018 Kurt Kanzenbach <kurt@kmk-computers.de>
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <functional>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstring>
+#include <clocale>
+#include <cerrno>
+
+#include <sys/stat.h>
+
+#include <kopt/kopt.h>
+
+#include "kwcng_config.h"
+#include "config.h"
+#include "concurrent_queue.h"
+#include "word_counter.h"
+#include "count_kernel.h"
+
+/**
+ * Throughput benchmarks for the counting kernels, the queue between the
+ * readers and the counting threads, the buffer counter and whole runs.
+ *
+ * The corpora are generated from a fixed seed, so the numbers stay
+ * comparable between machines and over time. Every result is printed as
+ * one line of semicolon separated values, the best of several runs.
+ */
+
+using Clock = std::chrono::steady_clock;
+
+struct Corpus {
+    std::string name;
+    std::string path;
+    std::size_t bytes;
+};
+
+static const char *const WORDS[] = {
+    "the", "of", "and", "a", "to", "in", "is", "you", "that", "it", "he", "was",
+    "for", "on", "are", "as", "with", "his", "they", "at", "be", "this", "have",
+    "from", "or", "one", "had", "by", "word", "but", "not", "what", "all", "were",
+    "counting", "threads", "throughput", "benchmark", "characters", "whitespace",
+};
+
+static std::string ascii_prose(std::mt19937_64& rng, std::size_t size, bool newlines)
+{
+    std::string text;
+
+    text.reserve(size);
+    for (std::size_t words = 1; text.size() < size; ++words) {
+        text += WORDS[rng() % (sizeof(WORDS) / sizeof(WORDS[0]))];
+        if (words % 17 == 0)
+            text += ".";
+        text += newlines && words % 12 == 0 ? '\n' : ' ';
+    }
+    text.resize(size);
+
+    return text;
+}
+
+static std::string cjk_text(std::mt19937_64& rng, std::size_t size)
+{
+    std::string text;
+
+    text.reserve(size + 3);
+    for (std::size_t chars = 1; text.size() < size; ++chars) {
+        // ideographs, with an ideographic space or a newline now and then
+        unsigned cp = chars % 40 == 0 ? '\n' : chars % 7 == 0 ? 0x3000 : 0x4e00 + rng() % 0x5200;
+
+        if (cp < 0x80) {
+            text += static_cast<char>(cp);
+            continue;
+        }
+        text += static_cast<char>(0xe0 | (cp >> 12));
+        text += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+        text += static_cast<char>(0x80 | (cp & 0x3f));
+    }
+
+    return text;
+}
+
+static std::string whitespace(std::mt19937_64& rng, std::size_t size)
+{
+    static const char spaces[] = { ' ', ' ', ' ', '\t', '\n' };
+    std::string text(size, ' ');
+
+    for (auto&& c: text)
+        c = spaces[rng() % sizeof(spaces)];
+
+    return text;
+}
+
+static bool write_file(const std::string& path, const std::string& data)
+{
+    std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+
+    ofs.write(data.data(), data.size());
+
+    return static_cast<bool>(ofs);
+}
+
+/**
+ * Creates the corpora in @dir, unless they exist with the same parameters
+ * already. The tiny files are spread over directories of 1000 files each.
+ */
+static std::vector<Corpus> generate(const std::string& dir, std::size_t size, std::size_t files)
+{
+    const auto stamp_path = dir + "/stamp";
+    std::vector<Corpus> corpora = {
+        { "ascii", dir + "/ascii.txt", size },
+        { "cjk", dir + "/cjk.txt", 0 },
+        { "line", dir + "/line.txt", size },
+        { "space", dir + "/space.txt", size },
+        { "tiny", dir + "/tiny", 0 },
+    };
+    std::mt19937_64 rng(42);
+    std::stringstream stamp;
+    std::ifstream ifs(stamp_path);
+    std::string line, expected;
+
+    stamp << size << ";" << files;
+    expected = stamp.str();
+    if (std::getline(ifs, line) && line.compare(0, expected.size() + 1, expected + ";") == 0) {
+        std::stringstream ss(line.substr(expected.size() + 1));
+        char sep;
+
+        ss >> corpora[1].bytes >> sep >> corpora[4].bytes;
+        return corpora;
+    }
+
+    ::mkdir(dir.c_str(), 0755);
+    ::mkdir(corpora[4].path.c_str(), 0755);
+
+    auto cjk = cjk_text(rng, size);
+    corpora[1].bytes = cjk.size();
+    if (!write_file(corpora[0].path, ascii_prose(rng, size, true)) ||
+        !write_file(corpora[1].path, cjk) ||
+        !write_file(corpora[2].path, ascii_prose(rng, size, false)) ||
+        !write_file(corpora[3].path, whitespace(rng, size)))
+        throw std::runtime_error("Failed to write corpus to " + dir + ": " +
+                                 std::strerror(errno));
+
+    for (std::size_t i = 0; i < files; ++i) {
+        auto sub = corpora[4].path + "/" + std::to_string(i / 1000);
+        auto text = ascii_prose(rng, 1 + rng() % 256, true);
+
+        if (i % 1000 == 0)
+            ::mkdir(sub.c_str(), 0755);
+        if (!write_file(sub + "/" + std::to_string(i % 1000) + ".txt", text))
+            throw std::runtime_error("Failed to write corpus to " + sub + ": " +
+                                     std::strerror(errno));
+        corpora[4].bytes += text.size();
+    }
+
+    std::ofstream ofs(stamp_path, std::ios::trunc);
+    ofs << expected << ";" << corpora[1].bytes << ";" << corpora[4].bytes << std::endl;
+
+    return corpora;
+}
+
+static std::string read_file(const std::string& path)
+{
+    std::ifstream ifs(path, std::ios::binary);
+    std::stringstream ss;
+
+    ss << ifs.rdbuf();
+
+    return ss.str();
+}
+
+/**
+ * Best of @repeat runs, in seconds.
+ */
+static double best_of(std::size_t repeat, const std::function<void()>& run)
+{
+    double best = 0;
+
+    for (std::size_t i = 0; i < repeat; ++i) {
+        auto start = Clock::now();
+
+        run();
+
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        if (!i || seconds < best)
+            best = seconds;
+    }
+
+    return best;
+}
+
+static void report(const std::string& bench, const std::string& corpus,
+                   const std::string& variant, std::size_t threads, std::size_t chunk_size,
+                   std::size_t bytes, double seconds)
+{
+    std::cout << bench << ";" << corpus << ";" << variant << ";" << threads << ";"
+              << chunk_size << ";" << bytes << ";" << seconds << ";"
+              << (seconds > 0 ? bytes / seconds / 1e9 : 0) << std::endl;
+}
+
+static void bench_kernels(const std::vector<Corpus>& corpora, std::size_t repeat)
+{
+    const std::uint32_t all = CountKernel::LINES | CountKernel::WORDS | CountKernel::CHARS;
+
+    for (auto&& corpus: corpora) {
+        if (corpus.name == "tiny")
+            continue;
+
+        auto data = read_file(corpus.path);
+        auto bytes = reinterpret_cast<const unsigned char *>(data.data());
+
+        for (auto&& kernel: CountKernel::available()) {
+            auto count = kernel->variant(all);
+            CountKernel::Counts counts;
+
+            auto seconds = best_of(repeat, [&] {
+                bool prev_space = true;
+
+                counts = CountKernel::Counts{};
+                count(bytes, data.size(), prev_space, counts);
+            });
+            report("kernel", corpus.name, kernel->name, 1, 0, data.size(), seconds);
+        }
+    }
+}
+
+/**
+ * Moves the given number of elements from one producer to @consumers
+ * threads, which is what the reader and the counting threads do with the
+ * loads.
+ */
+static void bench_queue(const std::vector<std::size_t>& threads, std::size_t repeat)
+{
+    static constexpr std::size_t ELEMENTS = 4 * 1024 * 1024;
+
+    for (auto consumers: threads) {
+        auto seconds = best_of(repeat, [&] {
+            ConcurrentQueue<std::size_t> queue(std::max<std::size_t>(consumers * 8, 64));
+            std::vector<std::thread> workers;
+
+            for (std::size_t i = 0; i < consumers; ++i)
+                workers.emplace_back([&] {
+                    while (queue.pop())
+                        ;
+                });
+            for (std::size_t i = 1; i <= ELEMENTS; ++i)
+                queue.push(std::size_t{i});
+            queue.wake_up();
+            for (auto&& worker: workers)
+                worker.join();
+        });
+
+        // in elements instead of bytes
+        report("queue", "-", "-", consumers, 0, ELEMENTS, seconds);
+    }
+}
+
+static void bench_buffer(const std::vector<Corpus>& corpora, const std::vector<std::size_t>& threads,
+                         std::size_t repeat)
+{
+    for (auto&& corpus: corpora) {
+        if (corpus.name == "tiny")
+            continue;
+
+        auto data = read_file(corpus.path);
+
+        for (auto count: threads) {
+            KwcNGConfig config;
+
+            config.max_threads = count;
+            WordCounter counter(config);
+
+            auto seconds = best_of(repeat, [&] { counter.count(data); });
+            report("buffer", corpus.name, "-", count, config.chunk_size, data.size(), seconds);
+        }
+    }
+}
+
+/**
+ * Throws the results away, only the time to count them is of interest.
+ */
+class Discard : public WordCounter::Output
+{
+public:
+    void file(const std::string&, const WordCountResult&) override
+    {}
+
+    void done(const WordCountResult&) override
+    {}
+};
+
+static void bench_runs(const std::vector<Corpus>& corpora, const std::vector<std::size_t>& threads,
+                       const std::vector<std::size_t>& chunk_sizes, std::size_t repeat)
+{
+    for (auto&& corpus: corpora) {
+        for (auto count: threads) {
+            for (auto chunk_size: chunk_sizes) {
+                KwcNGConfig config;
+
+                config.flags |= KwcNGOpt::LINES | KwcNGOpt::WORDS | KwcNGOpt::CHARS |
+                    KwcNGOpt::RECURSIVE;
+                config.max_threads = count;
+                config.chunk_size = chunk_size;
+
+                WordCounter counter(config);
+                Discard discard;
+
+                auto seconds = best_of(repeat, [&] {
+                    counter.run({ corpus.path }, discard);
+                });
+                report("run", corpus.name, "-", count, chunk_size, corpus.bytes, seconds);
+            }
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    Kopt::OptionParser parser{argc, argv};
+    std::string dir = "kwcng_bench_corpus";
+    std::size_t size = 64, files = 1000000, repeat = 3;
+    std::vector<std::size_t> threads, chunk_sizes = { 4096, 64 * 1024, 1024 * 1024 };
+
+    parser.add_argument_option("corpus", "directory of the generated corpora", 'd');
+    parser.add_argument_option("size", "size of each corpus in MiB", 's');
+    parser.add_argument_option("files", "number of tiny files", 'f');
+    parser.add_argument_option("repeat", "runs per measurement, the best one is reported", 'r');
+    parser.add_flag_option("help", "print this help text", 'h');
+
+    try {
+        parser.parse();
+
+        if (*parser["help"]) {
+            std::cerr << parser.get_usage("");
+            return EXIT_SUCCESS;
+        }
+        if (*parser["corpus"])
+            dir = parser["corpus"]->to<std::string>();
+        if (*parser["size"])
+            size = parser["size"]->to<std::size_t>();
+        if (*parser["files"])
+            files = parser["files"]->to<std::size_t>();
+        if (*parser["repeat"])
+            repeat = parser["repeat"]->to<std::size_t>();
+    } catch (const std::exception& ex) {
+        std::cerr << "Error while parsing command line arguments: " << ex.what()
+                  << std::endl;
+        std::cerr << parser.get_usage("");
+        return EXIT_FAILURE;
+    }
+    if (!size || !repeat) {
+        std::cerr << parser.get_usage("");
+        return EXIT_FAILURE;
+    }
+
+    // the CJK corpus requires a UTF-8 locale to classify its spaces
+    std::setlocale(LC_ALL, "");
+
+    for (std::size_t count = 1; count < std::thread::hardware_concurrency(); count *= 2)
+        threads.push_back(count);
+    threads.push_back(std::max(std::thread::hardware_concurrency(), 1u));
+
+    std::vector<Corpus> corpora;
+    try {
+        corpora = generate(dir, size * 1024 * 1024, files);
+    } catch (const std::exception& ex) {
+        std::cerr << "Error while generating the corpora: " << ex.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "# bench;corpus;variant;threads;chunk_size;bytes;seconds;gb_per_s" << std::endl;
+    bench_kernels(corpora, repeat);
+    bench_queue(threads, repeat);
+    bench_buffer(corpora, threads, repeat);
+    bench_runs(corpora, threads, chunk_sizes, repeat);
+
+    return EXIT_SUCCESS;
+}
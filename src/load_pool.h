@@ -0,0 +1,135 @@
+// Copyright 2018 Kurt Kanzenbach <kurt@kmk-computers.de>
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef _LOAD_POOL_H_
+#define _LOAD_POOL_H_
+
+#include <memory>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+
+#include "concurrent_queue.h"
+
+/**
+ * Recycles loads including their buffers.
+ *
+ * Readers take loads from the pool and the counting threads hand them
+ * back once they're done. Loads are created on demand up to @count, after
+ * that the readers block until a load is returned. Thus, the steady state
+ * is allocation free and the pool limits the number of loads in flight.
+ *
+ * The loads are numbered starting at @first, so that several pools may
+ * share one index space.
+ */
+template<typename Load>
+class LoadPool
+{
+public:
+    LoadPool(std::size_t count, std::size_t buffer_size, std::size_t first = 0) :
+        m_count{count},
+        m_buffer_size{buffer_size},
+        m_first{first},
+        m_created{0},
+        m_free{count}
+    {}
+
+    std::unique_ptr<Load> get()
+    {
+        std::unique_ptr<Load> load;
+
+        if (try_get(load))
+            return load;
+
+        // zZz
+        return m_free.pop();
+    }
+
+    bool try_get(std::unique_ptr<Load>& load)
+    {
+        if (m_free.try_pop(load))
+            return true;
+
+        load = create();
+
+        return load != nullptr;
+    }
+
+    /**
+     * Creates up to @count loads in the calling thread and writes their
+     * buffers, so that the memory is placed on the NUMA node of the
+     * calling thread rather than on the one of the first reader.
+     */
+    void prefill(std::size_t count)
+    {
+        for (std::size_t i = 0; i < count; ++i) {
+            auto load = create();
+
+            if (!load)
+                return;
+            std::memset(load->buffer(), 0, load->capacity() * sizeof(*load->buffer()));
+            m_free.push(std::move(load));
+        }
+    }
+
+    /**
+     * Maximum number of loads.
+     */
+    std::size_t count() const noexcept
+    {
+        return m_count;
+    }
+
+    std::size_t first() const noexcept
+    {
+        return m_first;
+    }
+
+    void put(std::unique_ptr<Load>&& load)
+    {
+        // don't keep mappings alive while the load sits in the pool
+        load->clear();
+        m_free.push(std::move(load));
+    }
+
+private:
+    std::unique_ptr<Load> create()
+    {
+        auto created = m_created.load();
+
+        while (created < m_count)
+            if (m_created.compare_exchange_weak(created, created + 1))
+                return std::make_unique<Load>(m_buffer_size, m_first + created);
+
+        return nullptr;
+    }
+
+    const std::size_t m_count;
+    const std::size_t m_buffer_size;
+    const std::size_t m_first;
+    std::atomic<std::size_t> m_created;
+    ConcurrentQueue<std::unique_ptr<Load>> m_free;
+};
+
+#endif /* _LOAD_POOL_H_ */
@@ -23,25 +23,101 @@
 // POSSIBILITY OF SUCH DAMAGE.
 
 #include <iostream>
+#include <iomanip>
 #include <stdexcept>
 #include <vector>
 #include <fstream>
 #include <string>
-#include <thread>
-#include <chrono>
-#include <functional>
 #include <cstdlib>
 #include <clocale>
 
+#include <unistd.h>
+
 #include <kopt/kopt.h>
 
 #include "kwcng_config.h"
 #include "config.h"
-#include "concurrent_queue.h"
 #include "word_counter.h"
+#include "topology.h"
+#include "chunk_sizer.h"
 #include "logger.h"
 
-using Threads = std::vector<std::thread>;
+/**
+ * Prints the results in the format selected on the command line.
+ */
+class Printer : public WordCounter::Output
+{
+public:
+    Printer(const KwcNGConfig& config, const WordCounter& counter) :
+        m_config{config}, m_counter{counter}, m_printed{0},
+        m_line_buffered{static_cast<bool>(::isatty(STDOUT_FILENO))}
+    {}
+
+    void file(const std::string& name, const WordCountResult& result) override
+    {
+        print(name, result);
+        // a terminal gets every line right away, everything else in blocks
+        if (m_line_buffered)
+            std::cout << std::flush;
+        if (result.invalid())
+            log_warn("File " << name << " contains " << result.invalid()
+                     << " invalid UTF-8 sequences");
+        m_printed++;
+    }
+
+    void done(const WordCountResult& global) override
+    {
+        if (m_printed > 1)
+            print("global", global);
+        m_printed = 0;
+
+        for (auto&& word: m_counter.words()) {
+            if (m_config.flags & KwcNGOpt::PARSEABLE)
+                std::cout << word.first << ";" << word.second << "\n";
+            else
+                std::cout << "word: " << std::setw(24) << word.first
+                          << " count: " << std::setw(10) << word.second << "\n";
+        }
+        std::cout << std::flush;
+
+        const auto& sizer = m_counter.sizer();
+        if ((m_config.flags & KwcNGOpt::AUTO_CHUNK_SIZE) &&
+            !(m_config.flags & KwcNGOpt::PARSEABLE))
+            log_info("Chunk size started at " << sizer.initial() << " and settled at "
+                     << sizer.size() << " (min " << sizer.min() << ", max "
+                     << sizer.max() << ")");
+    }
+
+private:
+    void print(const std::string& file, const WordCountResult& result) const
+    {
+        if (m_config.flags & KwcNGOpt::PARSEABLE) {
+            std::cout << file << ";" << result.lines() << ";"
+                      << result.words() << ";" << result.chars();
+            // appended, so that existing scripts keep working
+            if (m_config.flags & KwcNGOpt::BYTES)
+                std::cout << ";" << result.bytes();
+            std::cout << "\n";
+            return;
+        }
+
+        std::cout << "file: " << std::setw(24) << file;
+        if (m_config.flags & KwcNGOpt::LINES)
+            std::cout << " lines: " << std::setw(10) << result.lines();
+        if (m_config.flags & KwcNGOpt::WORDS)
+            std::cout << " words: " << std::setw(10) << result.words();
+        if (m_config.flags & KwcNGOpt::CHARS)
+            std::cout << " chars: " << std::setw(10) << result.chars();
+        if (m_config.flags & KwcNGOpt::BYTES)
+            std::cout << " bytes: " << std::setw(10) << result.bytes();
+        std::cout << "\n";
+    }
+
+    const KwcNGConfig& m_config;
+    const WordCounter& m_counter;
+    std::size_t m_printed;
+    bool m_line_buffered;
+};
 
 [[noreturn]] static inline
 void print_usage_and_die(const Kopt::OptionParser& parser, int die)
@@ -66,16 +142,36 @@ int main(int argc, char *argv[])
 {
     Kopt::OptionParser parser{argc, argv};
     WordCounter::Files files;
-    WordCounter counter;
-    Threads threads;
+    KwcNGConfig config;
+
+    // stdin is read through its file descriptor, the wide streams don't
+    // need to be synchronized with stdio either
+    std::ios_base::sync_with_stdio(false);
 
     // setup arguments
     parser.add_flag_option("lines", "count lines", 'l');
     parser.add_flag_option("words", "count words", 'w');
     parser.add_flag_option("chars", "count characters", 'c');
+    parser.add_flag_option("bytes", "count bytes", 'b');
     parser.add_flag_option("parseable", "parseable output for use in scripts", 'p');
+    parser.add_flag_option("ordered", "print the results in the order of the files", 'o');
+    parser.add_flag_option("validate", "report invalid UTF-8 input", 'u');
+    parser.add_flag_option("io_uring", "read regular files with io_uring", 'g');
+    parser.add_flag_option("direct", "bypass the page cache when reading with io_uring", 'd');
+    parser.add_flag_option("recursive", "count the files in directories recursively", 'R');
+    parser.add_flag_option("freq", "count the occurrences of every word", 'q');
+    parser.add_argument_option("top", "only print the given number of most frequent words", 'K');
+    parser.add_flag_option("follow", "keep counting what's appended to regular files", 'f');
+    parser.add_flag_option("stats", "print pipeline stats as JSON to stderr", 'S');
+    parser.add_flag_option("steal", "let the counting threads split and steal regular files", 's');
     parser.add_argument_option("max_threads", "maximum number of threads to be used", 'm');
+    parser.add_argument_option("cpus", "CPUs to pin the counting threads to, e.g. 0-3,8", 'C');
     parser.add_argument_option("chunk_size", "thread workload size", 't');
+    parser.add_flag_option("auto_chunk_size", "adapt the thread workload size at runtime", 'a');
+    parser.add_argument_option("max_inflight_bytes", "maximum number of bytes queued or being counted", 'i');
+    parser.add_argument_option("max_readers", "maximum number of files read at once", 'r');
+    parser.add_argument_option("interval", "milliseconds between the updates in follow mode", 'n');
+    parser.add_argument_option("cache", "file to cache the counts of regular files in", 'k');
     parser.add_flag_option("help", "print this help text", 'h');
     parser.add_flag_option("version", "print version information", 'v');
 
@@ -94,43 +190,90 @@ int main(int argc, char *argv[])
             config.flags |= KwcNGOpt::WORDS;
         if (*parser["chars"])
             config.flags |= KwcNGOpt::CHARS;
+        if (*parser["bytes"])
+            config.flags |= KwcNGOpt::BYTES;
         if (*parser["parseable"])
             config.flags |= KwcNGOpt::PARSEABLE;
+        if (*parser["ordered"])
+            config.flags |= KwcNGOpt::ORDERED;
+        if (*parser["validate"])
+            config.flags |= KwcNGOpt::VALIDATE;
+        if (*parser["io_uring"])
+            config.flags |= KwcNGOpt::IO_URING;
+        if (*parser["direct"])
+            config.flags |= KwcNGOpt::DIRECT;
+        if (*parser["recursive"])
+            config.flags |= KwcNGOpt::RECURSIVE;
+        if (*parser["freq"])
+            config.flags |= KwcNGOpt::FREQ;
+        if (*parser["top"]) {
+            config.flags |= KwcNGOpt::FREQ;
+            config.top = parser["top"]->to<std::size_t>();
+        }
+        if (*parser["follow"])
+            config.flags |= KwcNGOpt::FOLLOW;
+        if (*parser["stats"])
+            config.flags |= KwcNGOpt::STATS;
+        if (*parser["steal"])
+            config.flags |= KwcNGOpt::STEAL;
         if (*parser["max_threads"])
             config.max_threads = parser["max_threads"]->to<std::size_t>();
+        if (*parser["cpus"]) {
+            config.cpus = Topology::parse_cpus(parser["cpus"]->to<std::string>());
+            if (config.cpus.empty())
+                throw std::invalid_argument("invalid CPU list");
+        }
         if (*parser["chunk_size"])
             config.chunk_size = parser["chunk_size"]->to<std::size_t>();
+        if (*parser["auto_chunk_size"])
+            config.flags |= KwcNGOpt::AUTO_CHUNK_SIZE;
+        if (*parser["max_inflight_bytes"])
+            config.max_inflight_bytes = parser["max_inflight_bytes"]->to<std::size_t>();
+        if (*parser["max_readers"])
+            config.max_readers = parser["max_readers"]->to<std::size_t>();
+        if (*parser["cache"])
+            config.cache_file = parser["cache"]->to<std::string>();
+        if (*parser["interval"])
+            config.follow_interval = parser["interval"]->to<std::size_t>();
     } catch (const std::exception& ex) {
         std::cerr << "Error while parsing command line arguments: " << ex.what()
                   << std::endl;
         print_usage_and_die(parser, 1);
     }
-    if (!config.max_threads || !config.chunk_size)
+    if (!config.max_threads || !config.chunk_size || !config.max_readers ||
+        !config.follow_interval)
         print_usage_and_die(parser, 1);
-    if (!(config.flags & (KwcNGOpt::LINES | KwcNGOpt::WORDS | KwcNGOpt::CHARS)))
+    if (!(config.flags & (KwcNGOpt::LINES | KwcNGOpt::WORDS | KwcNGOpt::CHARS |
+                          KwcNGOpt::BYTES)))
         config.flags |= KwcNGOpt::LINES | KwcNGOpt::WORDS | KwcNGOpt::CHARS;
 
+    // results are printed as soon as their files have been counted
+    config.flags |= KwcNGOpt::STREAM;
+
     files = parser.unparsed_options();
     if (files.empty())
         files.emplace_back("stdin");
 
+    if (config.flags & KwcNGOpt::AUTO_CHUNK_SIZE)
+        config.chunk_size = ChunkSizer::initial(files, config.max_threads);
+
     if (!std::setlocale(LC_ALL, "")) {
         log_err("setlocale() failed");
         return EXIT_FAILURE;
     }
 
-    threads.reserve(config.max_threads);
-    for (auto i = 0u; i < config.max_threads; ++i)
-        threads.emplace_back(std::bind(&WordCounter::count_thread, &counter));
-
-    counter.distribute_work(files);
+    // the results are printed by the counting threads while the readers
+    // log, a tied std::cerr would flush std::cout from the reader threads
+    std::cerr.tie(nullptr);
 
-    counter.stop();
+    WordCounter counter(config);
+    Printer printer(config, counter);
 
-    for (auto i = 0u; i < config.max_threads; ++i)
-        threads[i].join();
+    counter.run(files, printer);
+    counter.print_stats(std::cerr);
 
-    counter.print_results();
+    if (config.flags & KwcNGOpt::FOLLOW)
+        counter.follow(printer);
 
     return 0;
 }
@@ -0,0 +1,144 @@
+// Copyright 2018 Kurt Kanzenbach <kurt@kmk-computers.de>
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef _MAPPED_FILE_H_
+#define _MAPPED_FILE_H_
+
+#include <memory>
+#include <string>
+#include <cstddef>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * Read-only memory mapping of a regular file.
+ *
+ * The mapping is shared by all loads of one file and released as soon
+ * as the last load has been counted. Files which cannot be mapped
+ * (pipes, devices, empty or procfs files) yield a nullptr and have to
+ * be read by the stream path instead.
+ *
+ * Anonymous mappings hold decompressed input, which is shared by the
+ * loads the same way.
+ */
+class MappedFile
+{
+public:
+    MappedFile(const char *data, std::size_t size) :
+        m_data{data}, m_size{size}
+    {}
+
+    MappedFile(const MappedFile& other) = delete;
+    MappedFile& operator=(const MappedFile& other) = delete;
+
+    ~MappedFile()
+    {
+        ::munmap(const_cast<char *>(m_data), m_size);
+    }
+
+    static std::shared_ptr<const MappedFile> map(int fd)
+    {
+        struct stat st;
+        void *data;
+
+        if (::fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size <= 0)
+            return nullptr;
+
+        data = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+            return nullptr;
+
+        ::madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+        return std::make_shared<const MappedFile>(
+            static_cast<const char *>(data), st.st_size);
+    }
+
+    static std::shared_ptr<const MappedFile> map(const std::string& file)
+    {
+        int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return nullptr;
+
+        auto map = MappedFile::map(fd);
+        ::close(fd);
+
+        return map;
+    }
+
+    /**
+     * Anonymous mapping of @size bytes. It's filled by the caller before
+     * it's handed to any load.
+     */
+    static std::shared_ptr<MappedFile> allocate(std::size_t size)
+    {
+        void *data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (data == MAP_FAILED)
+            return nullptr;
+
+        return std::make_shared<MappedFile>(static_cast<const char *>(data), size);
+    }
+
+    /**
+     * Asks the kernel to read ahead the given range. Offset is rounded
+     * down to the page size.
+     */
+    void will_need(std::size_t offset, std::size_t len) const noexcept
+    {
+        static const std::size_t page_size = ::sysconf(_SC_PAGESIZE);
+        auto start = offset & ~(page_size - 1);
+
+        if (start >= m_size)
+            return;
+        if (len > m_size - start)
+            len = m_size - start;
+
+        ::madvise(const_cast<char *>(m_data) + start, len, MADV_WILLNEED);
+    }
+
+    const char *data() const noexcept
+    {
+        return m_data;
+    }
+
+    std::size_t size() const noexcept
+    {
+        return m_size;
+    }
+
+    char *writable() noexcept
+    {
+        return const_cast<char *>(m_data);
+    }
+
+private:
+    const char *m_data;
+    std::size_t m_size;
+};
+
+#endif /* _MAPPED_FILE_H_ */
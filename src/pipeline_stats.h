@@ -0,0 +1,168 @@
+// Copyright 2018 Kurt Kanzenbach <kurt@kmk-computers.de>
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef _PIPELINE_STATS_H_
+#define _PIPELINE_STATS_H_
+
+#include <mutex>
+#include <chrono>
+#include <vector>
+#include <ostream>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Timings and counters of the reading and counting stages.
+ *
+ * Every thread accumulates into its own instance of ReaderStats or
+ * WorkerStats without any synchronization and hands it in once it is
+ * done. The readers don't know which thread they are on, so theirs is
+ * kept thread local. Nothing is measured unless enabled, which leaves a
+ * predictable branch per load.
+ */
+class PipelineStats
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct ReaderStats {
+        std::uint64_t busy_ns{0};
+        std::uint64_t blocked_ns{0};
+        std::size_t loads{0};
+        std::size_t bytes{0};
+        std::size_t max_depth{0};
+    };
+
+    struct WorkerStats {
+        std::uint64_t busy_ns{0};
+        std::uint64_t idle_ns{0};
+        std::size_t chunks{0};
+        std::size_t bytes{0};
+    };
+
+    explicit PipelineStats(bool enabled) :
+        m_enabled{enabled}, m_max_depth{0}
+    {}
+
+    bool enabled() const noexcept
+    {
+        return m_enabled;
+    }
+
+    static std::uint64_t ns(Clock::duration duration) noexcept
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+    }
+
+    /**
+     * Stats of the reader running on the calling thread.
+     */
+    static ReaderStats& reader() noexcept
+    {
+        static thread_local ReaderStats stats;
+
+        return stats;
+    }
+
+    /**
+     * Starts a run, the stats of the previous one are dropped.
+     */
+    void start()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        m_start = Clock::now();
+        m_max_depth = 0;
+        m_readers.clear();
+        m_workers.clear();
+    }
+
+    /**
+     * Hands in the stats of the reader on the calling thread.
+     */
+    void add_reader()
+    {
+        auto& stats = reader();
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        m_readers.push_back(stats);
+        if (stats.max_depth > m_max_depth)
+            m_max_depth = stats.max_depth;
+        stats = ReaderStats{};
+    }
+
+    void add_worker(const WorkerStats& stats)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        m_workers.push_back(stats);
+    }
+
+    void print_json(std::ostream& os, std::size_t files, std::size_t bytes,
+                    std::size_t queue_capacity) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto wall_ns = ns(Clock::now() - m_start);
+
+        os << "{\"wall_ns\":" << wall_ns
+           << ",\"files\":" << files
+           << ",\"bytes\":" << bytes
+           << ",\"bytes_per_second\":"
+           << (wall_ns ? static_cast<std::uint64_t>(bytes * 1e9 / wall_ns) : 0)
+           << ",\"queue\":{\"capacity\":" << queue_capacity
+           << ",\"max_depth\":" << m_max_depth << "}"
+           << ",\"readers\":[";
+        for (std::size_t i = 0; i < m_readers.size(); ++i) {
+            const auto& reader = m_readers[i];
+
+            os << (i ? "," : "")
+               << "{\"busy_ns\":" << reader.busy_ns
+               << ",\"blocked_ns\":" << reader.blocked_ns
+               << ",\"loads\":" << reader.loads
+               << ",\"bytes\":" << reader.bytes << "}";
+        }
+        os << "],\"workers\":[";
+        for (std::size_t i = 0; i < m_workers.size(); ++i) {
+            const auto& worker = m_workers[i];
+
+            os << (i ? "," : "")
+               << "{\"busy_ns\":" << worker.busy_ns
+               << ",\"idle_ns\":" << worker.idle_ns
+               << ",\"chunks\":" << worker.chunks
+               << ",\"bytes\":" << worker.bytes << "}";
+        }
+        os << "]}" << std::endl;
+    }
+
+private:
+    bool m_enabled;
+    Clock::time_point m_start;
+    std::size_t m_max_depth;
+    std::vector<ReaderStats> m_readers;
+    std::vector<WorkerStats> m_workers;
+    mutable std::mutex m_mutex;
+};
+
+#endif /* _PIPELINE_STATS_H_ */
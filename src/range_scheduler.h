@@ -0,0 +1,184 @@
+// Copyright 2018 Kurt Kanzenbach <kurt@kmk-computers.de>
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef _RANGE_SCHEDULER_H_
+#define _RANGE_SCHEDULER_H_
+
+#include <mutex>
+#include <deque>
+#include <vector>
+#include <cstddef>
+#include <condition_variable>
+
+#include "concurrent_queue.h"
+#include "file_table.h"
+
+/**
+ * Byte range [begin, end) of an input file.
+ */
+struct Range {
+    FileId file;
+    std::size_t begin;
+    std::size_t end;
+};
+
+/**
+ * Hands out file ranges to the counting threads without a reader in
+ * between.
+ *
+ * Every worker owns a deque of ranges. It takes chunks of @granule bytes
+ * from the front of its own deque and, once that runs dry, steals half
+ * of the last range of another worker. Split points are multiples of the
+ * granule relative to the file start.
+ *
+ * All ranges are added before the scheduler is sealed. Workers wait for
+ * that, afterwards an empty scheduler means there is nothing left to do.
+ */
+class RangeScheduler
+{
+public:
+    RangeScheduler(std::size_t workers, std::size_t granule) :
+        m_deques(workers), m_granule{granule}, m_next{0}, m_sealed{false}
+    {}
+
+    void add(const Range& range)
+    {
+        auto& deque = m_deques[m_next++ % m_deques.size()];
+        std::lock_guard<std::mutex> lock(deque.mutex);
+
+        deque.ranges.push_back(range);
+    }
+
+    /**
+     * Starts over for another run, once all ranges have been handed out.
+     */
+    void reset()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        m_next = 0;
+        m_sealed = false;
+    }
+
+    void seal()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        m_sealed = true;
+        m_cv.notify_all();
+    }
+
+    void wait_sealed()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        // zZz
+        m_cv.wait(lock, [&] { return m_sealed; });
+    }
+
+    /**
+     * Claims the next chunk for @worker. Returns false if all ranges
+     * have been handed out.
+     */
+    bool next(std::size_t worker, Range& range)
+    {
+        if (pop(worker, range))
+            return true;
+
+        for (std::size_t i = 1; i < m_deques.size(); ++i) {
+            Range stolen;
+
+            if (!steal((worker + i) % m_deques.size(), stolen))
+                continue;
+
+            {
+                auto& deque = m_deques[worker];
+                std::lock_guard<std::mutex> lock(deque.mutex);
+
+                deque.ranges.push_back(stolen);
+            }
+
+            return pop(worker, range);
+        }
+
+        return false;
+    }
+
+private:
+    struct alignas(CACHE_LINE_SIZE) Deque {
+        std::mutex mutex;
+        std::deque<Range> ranges;
+    };
+
+    bool pop(std::size_t worker, Range& range)
+    {
+        auto& deque = m_deques[worker];
+        std::lock_guard<std::mutex> lock(deque.mutex);
+
+        if (deque.ranges.empty())
+            return false;
+
+        auto& front = deque.ranges.front();
+
+        range = front;
+        if (front.end - front.begin > m_granule) {
+            range.end = front.begin + m_granule;
+            front.begin = range.end;
+        } else
+            deque.ranges.pop_front();
+
+        return true;
+    }
+
+    bool steal(std::size_t victim, Range& range)
+    {
+        auto& deque = m_deques[victim];
+        std::lock_guard<std::mutex> lock(deque.mutex);
+
+        if (deque.ranges.empty())
+            return false;
+
+        auto& back = deque.ranges.back();
+        auto granules = (back.end - back.begin + m_granule - 1) / m_granule;
+
+        range = back;
+        if (granules > 1) {
+            range.begin = back.begin + granules / 2 * m_granule;
+            back.end = range.begin;
+        } else
+            deque.ranges.pop_back();
+
+        return true;
+    }
+
+    std::vector<Deque> m_deques;
+    std::size_t m_granule;
+    std::size_t m_next;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_sealed;
+};
+
+#endif /* _RANGE_SCHEDULER_H_ */
@@ -0,0 +1,214 @@
+// Copyright 2018 Kurt Kanzenbach <kurt@kmk-computers.de>
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef _RESULT_STREAM_H_
+#define _RESULT_STREAM_H_
+
+#include <map>
+#include <array>
+#include <mutex>
+#include <cstddef>
+#include <functional>
+#include <unordered_map>
+#include <condition_variable>
+
+#include "file_table.h"
+#include "word_count_result.h"
+#include "concurrent_queue.h"
+
+/**
+ * Hands out the result of each file as soon as it has been counted
+ * completely.
+ *
+ * The reader holds a reference on a file from open() to close(), every
+ * queued load holds another one until it has been counted. Whoever drops
+ * the last reference emits the result, which is forgotten afterwards. So
+ * only the files in flight are kept.
+ *
+ * In ordered mode the results are emitted by increasing file id. Files
+ * which complete early wait in a reorder buffer, and readers wait before
+ * they start a file more than @window ids ahead of the next one due.
+ */
+class ResultStream
+{
+public:
+    using Emit = std::function<void(const WordCountResult& result)>;
+
+    /**
+     * @emit is called for one result at a time.
+     */
+    ResultStream(bool ordered, std::size_t window, Emit emit) :
+        m_ordered{ordered}, m_window{window ? window : 1}, m_emit{std::move(emit)}, m_next{0}
+    {}
+
+    void open(FileId file)
+    {
+        auto& shard = m_shards[file % SHARDS];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto& pending = shard.files[file];
+
+        pending.result.file() = file;
+        pending.refs++;
+    }
+
+    void ref(FileId file)
+    {
+        auto& shard = m_shards[file % SHARDS];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        shard.files[file].refs++;
+    }
+
+    /**
+     * Adds counts without dropping a reference.
+     */
+    void add(const WordCountResult& counts)
+    {
+        auto& shard = m_shards[counts.file() % SHARDS];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto& pending = shard.files[counts.file()];
+
+        pending.result.file() = counts.file();
+        pending.result += counts;
+    }
+
+    /**
+     * Adds the counts of a load and drops its reference.
+     */
+    void release(const WordCountResult& counts)
+    {
+        auto& shard = m_shards[counts.file() % SHARDS];
+        WordCountResult result;
+
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            auto it = shard.files.find(counts.file());
+
+            if (it == shard.files.end())
+                return;
+
+            it->second.result += counts;
+            if (--it->second.refs)
+                return;
+
+            result = it->second.result;
+            shard.files.erase(it);
+        }
+
+        emit(result);
+    }
+
+    void close(FileId file)
+    {
+        WordCountResult none;
+
+        none.file() = file;
+        release(none);
+    }
+
+    /**
+     * Whether a reader may start @file without waiting.
+     */
+    bool fits(FileId file) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        return !m_ordered || file < m_next + m_window;
+    }
+
+    void wait(FileId file)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        // zZz
+        m_cv.wait(lock, [&] { return !m_ordered || file < m_next + m_window; });
+    }
+
+    /**
+     * Emits whatever is left in file order, once nothing is in flight
+     * anymore.
+     */
+    void finish()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        for (auto&& shard: m_shards) {
+            std::lock_guard<std::mutex> shard_lock(shard.mutex);
+
+            for (auto&& entry: shard.files)
+                m_ready.emplace(entry.first, entry.second.result);
+            shard.files.clear();
+        }
+
+        for (auto&& entry: m_ready)
+            m_emit(entry.second);
+        m_ready.clear();
+
+        // the next run starts with file id 0 again
+        m_next = 0;
+    }
+
+private:
+    static constexpr std::size_t SHARDS = 16;
+
+    struct Pending {
+        WordCountResult result;
+        std::size_t refs{0};
+    };
+
+    struct alignas(CACHE_LINE_SIZE) Shard {
+        std::mutex mutex;
+        std::unordered_map<FileId, Pending> files;
+    };
+
+    void emit(const WordCountResult& result)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if (!m_ordered) {
+            m_emit(result);
+            return;
+        }
+
+        m_ready.emplace(result.file(), result);
+        while (!m_ready.empty() && m_ready.begin()->first == m_next) {
+            m_emit(m_ready.begin()->second);
+            m_ready.erase(m_ready.begin());
+            m_next++;
+        }
+        m_cv.notify_all();
+    }
+
+    const bool m_ordered;
+    const std::size_t m_window;
+    Emit m_emit;
+    std::array<Shard, SHARDS> m_shards;
+    std::map<FileId, WordCountResult> m_ready;
+    FileId m_next;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cv;
+};
+
+#endif /* _RESULT_STREAM_H_ */
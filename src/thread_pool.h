@@ -0,0 +1,143 @@
+// Copyright 2018 Kurt Kanzenbach <kurt@kmk-computers.de>
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef _THREAD_POOL_H_
+#define _THREAD_POOL_H_
+
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <condition_variable>
+
+/**
+ * Fixed set of threads running batches of indexed tasks.
+ *
+ * The threads are started once and wait for the next batch, so that
+ * counting many small buffers doesn't pay for thread creation each time.
+ * The calling thread takes part in each batch, thus a pool of size one
+ * doesn't start any threads at all. Batches are run one at a time.
+ */
+class ThreadPool
+{
+public:
+    explicit ThreadPool(std::size_t size) :
+        m_task{nullptr}, m_count{0}, m_next{0}, m_done{0}, m_generation{0}, m_stop{false}
+    {
+        for (std::size_t i = 1; i < size; ++i)
+            m_threads.emplace_back(&ThreadPool::worker, this);
+    }
+
+    ThreadPool(const ThreadPool& other) = delete;
+    ThreadPool& operator=(const ThreadPool& other) = delete;
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            m_stop = true;
+            m_work_cv.notify_all();
+        }
+        for (auto&& thread: m_threads)
+            thread.join();
+    }
+
+    std::size_t size() const noexcept
+    {
+        return m_threads.size() + 1;
+    }
+
+    /**
+     * Runs @task(i) for every i below @count and waits until all of them
+     * are done.
+     */
+    void run(std::size_t count, const std::function<void(std::size_t)>& task)
+    {
+        std::lock_guard<std::mutex> batch(m_run_mutex);
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        m_task = &task;
+        m_count = count;
+        m_next = 0;
+        m_done = 0;
+        m_generation++;
+        m_work_cv.notify_all();
+
+        execute(lock);
+
+        // zZz
+        m_done_cv.wait(lock, [&] { return m_done == m_count; });
+        m_task = nullptr;
+    }
+
+private:
+    void worker()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        std::uint64_t seen = 0;
+
+        while (42) {
+            // zZz
+            m_work_cv.wait(lock, [&] { return m_stop || m_generation != seen; });
+            if (m_stop)
+                return;
+
+            seen = m_generation;
+            execute(lock);
+        }
+    }
+
+    void execute(std::unique_lock<std::mutex>& lock)
+    {
+        while (m_next < m_count) {
+            auto index = m_next++;
+            auto task = m_task;
+
+            lock.unlock();
+            (*task)(index);
+            lock.lock();
+
+            if (++m_done == m_count)
+                m_done_cv.notify_all();
+        }
+    }
+
+    std::vector<std::thread> m_threads;
+    const std::function<void(std::size_t)> *m_task;
+    std::size_t m_count;
+    std::size_t m_next;
+    std::size_t m_done;
+    std::uint64_t m_generation;
+    bool m_stop;
+    std::mutex m_run_mutex;
+    std::mutex m_mutex;
+    std::condition_variable m_work_cv;
+    std::condition_variable m_done_cv;
+};
+
+#endif /* _THREAD_POOL_H_ */
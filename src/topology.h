@@ -0,0 +1,139 @@
+// Copyright 2018 Kurt Kanzenbach <kurt@kmk-computers.de>
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef _TOPOLOGY_H_
+#define _TOPOLOGY_H_
+
+#include "kwcng_config.h"
+
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+
+#include <dirent.h>
+#include <pthread.h>
+#ifdef KWCNG_AFFINITY
+#include <sched.h>
+#endif
+
+/**
+ * Placement of the counting threads on CPUs and NUMA nodes.
+ *
+ * The node of a CPU is taken from sysfs, so there is no dependency on
+ * libnuma. Without sysfs every CPU is on node 0.
+ */
+namespace Topology {
+
+// CPUs beyond don't fit into a cpu_set_t
+static constexpr unsigned MAX_CPUS = 1024;
+
+/**
+ * Parses a CPU list such as "0-3,8,10-11". Returns nothing, if it's
+ * malformed.
+ */
+static inline std::vector<unsigned> parse_cpus(const std::string& list)
+{
+    std::vector<unsigned> cpus;
+    auto p = list.c_str();
+
+    while (*p) {
+        char *end;
+        auto first = std::strtoul(p, &end, 10);
+        auto last = first;
+
+        if (end == p)
+            return {};
+        if (*end == '-') {
+            p = end + 1;
+            last = std::strtoul(p, &end, 10);
+            if (end == p)
+                return {};
+        }
+        if (first > last || last >= MAX_CPUS)
+            return {};
+
+        for (auto cpu = first; cpu <= last; ++cpu)
+            cpus.push_back(cpu);
+
+        p = end;
+        if (*p == ',' && *++p == '\0')
+            return {};
+        else if (*p && *p != ',')
+            return {};
+    }
+
+    return cpus;
+}
+
+static inline unsigned node_of(unsigned cpu)
+{
+    const auto path = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+    unsigned node = 0;
+
+    auto dir = ::opendir(path.c_str());
+    if (!dir)
+        return 0;
+
+    // the node is linked as nodeN
+    while (auto entry = ::readdir(dir)) {
+        char *end;
+
+        if (std::strncmp(entry->d_name, "node", 4))
+            continue;
+
+        auto value = std::strtoul(entry->d_name + 4, &end, 10);
+        if (end != entry->d_name + 4 && !*end) {
+            node = value;
+            break;
+        }
+    }
+    ::closedir(dir);
+
+    return node;
+}
+
+/**
+ * Pins the calling thread to @cpu. Returns false, if that's not
+ * supported or the CPU isn't available.
+ */
+static inline bool pin(unsigned cpu)
+{
+#ifdef KWCNG_AFFINITY
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    return !::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set);
+#else
+    (void)cpu;
+    return false;
+#endif
+}
+
+}
+
+#endif /* _TOPOLOGY_H_ */
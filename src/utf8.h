@@ -0,0 +1,206 @@
+// Copyright 2018 Kurt Kanzenbach <kurt@kmk-computers.de>
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef _UTF8_H_
+#define _UTF8_H_
+
+#include <cstddef>
+#include <cwctype>
+#include <cstring>
+
+#include <langinfo.h>
+
+/**
+ * Helpers for counting directly on UTF-8 encoded bytes.
+ *
+ * Characters are counted as non-continuation bytes. Whitespace is
+ * classified by iswspace(), but only code points which can actually be
+ * whitespace are decoded: ASCII and the three byte sequences starting
+ * with 0xe1, 0xe2 and 0xe3 (U+1680, U+2000 - U+205f and U+3000).
+ */
+namespace Utf8 {
+
+// bytes of an incomplete character at the end of a buffer
+static constexpr std::size_t MAX_CARRY = 3;
+
+static inline bool locale_is_utf8() noexcept
+{
+    auto codeset = ::nl_langinfo(CODESET);
+
+    return codeset && (!std::strcmp(codeset, "UTF-8") ||
+                       !std::strcmp(codeset, "utf8"));
+}
+
+static inline bool is_continuation(unsigned char c) noexcept
+{
+    return (c & 0xc0) == 0x80;
+}
+
+static inline bool is_ascii_space(unsigned char c) noexcept
+{
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+/**
+ * Decodes the character starting at @p. Invalid or truncated sequences
+ * yield U+FFFD.
+ */
+static inline wchar_t decode(const unsigned char *p, const unsigned char *end) noexcept
+{
+    std::size_t len;
+    wchar_t c;
+
+    if (*p < 0x80)
+        return *p;
+    if (*p >= 0xc2 && *p <= 0xdf) {
+        len = 2;
+        c = *p & 0x1f;
+    } else if (*p >= 0xe0 && *p <= 0xef) {
+        len = 3;
+        c = *p & 0x0f;
+    } else if (*p >= 0xf0 && *p <= 0xf4) {
+        len = 4;
+        c = *p & 0x07;
+    } else
+        return 0xfffd;
+
+    if (static_cast<std::size_t>(end - p) < len)
+        return 0xfffd;
+    for (std::size_t i = 1; i < len; ++i) {
+        if (!is_continuation(p[i]))
+            return 0xfffd;
+        c = (c << 6) | (p[i] & 0x3f);
+    }
+
+    return c;
+}
+
+/**
+ * Checks the sequence starting at @p. Returns its length if it's valid.
+ * Otherwise, the negated number of bytes forming the maximal invalid
+ * subpart is returned, which is what has to be skipped.
+ */
+static inline int sequence(const unsigned char *p, const unsigned char *end) noexcept
+{
+    unsigned char lo = 0x80, hi = 0xbf;
+    int len;
+
+    if (*p < 0x80)
+        return 1;
+    if (*p < 0xc2)
+        return -1;
+
+    if (*p < 0xe0)
+        len = 2;
+    else if (*p < 0xf0) {
+        len = 3;
+        if (*p == 0xe0)
+            lo = 0xa0;
+        else if (*p == 0xed)
+            hi = 0x9f;
+    } else if (*p < 0xf5) {
+        len = 4;
+        if (*p == 0xf0)
+            lo = 0x90;
+        else if (*p == 0xf4)
+            hi = 0x8f;
+    } else
+        return -1;
+
+    for (int i = 1; i < len; ++i) {
+        if (p + i == end || p[i] < lo || p[i] > hi)
+            return -i;
+        lo = 0x80;
+        hi = 0xbf;
+    }
+
+    return len;
+}
+
+/**
+ * Whitespace classification of the character starting at @p. Must not
+ * be called on continuation bytes.
+ */
+static inline bool is_space(const unsigned char *p, const unsigned char *end) noexcept
+{
+    if (*p < 0x80)
+        return is_ascii_space(*p);
+    if (*p < 0xe1 || *p > 0xe3)
+        return false;
+
+    return std::iswspace(decode(p, end));
+}
+
+/**
+ * Returns the character ending right before @pos as far as whitespace
+ * classification is concerned, i.e. other non ASCII characters yield
+ * U+FFFD. A space is returned if @pos is the beginning of the data.
+ */
+static inline wchar_t prev_char(const unsigned char *begin, const unsigned char *pos) noexcept
+{
+    if (pos == begin)
+        return L' ';
+    if (pos - begin >= 3 && pos[-3] >= 0xe1 && pos[-3] <= 0xe3 &&
+        is_space(pos - 3, pos))
+        return decode(pos - 3, pos);
+
+    return pos[-1] < 0x80 ? pos[-1] : 0xfffd;
+}
+
+/**
+ * Moves @pos forward to the next character boundary, so that loads never
+ * split a multi byte sequence.
+ */
+static inline std::size_t align(const unsigned char *data, std::size_t pos,
+                                std::size_t size) noexcept
+{
+    for (int i = 0; i < 3 && pos < size && is_continuation(data[pos]); ++i)
+        ++pos;
+
+    return pos;
+}
+
+/**
+ * Returns the length of the longest prefix of @data which doesn't end
+ * within a multi byte sequence. Used by the stream readers to carry an
+ * incomplete character over to the next load.
+ */
+static inline std::size_t boundary(const unsigned char *data, std::size_t size) noexcept
+{
+    for (std::size_t i = 1; i <= 3 && i <= size; ++i) {
+        auto c = data[size - i];
+
+        if (is_continuation(c))
+            continue;
+        if ((c >= 0xf0 && i < 4) || (c >= 0xe0 && i < 3) || (c >= 0xc0 && i < 2))
+            return size - i;
+        break;
+    }
+
+    return size;
+}
+
+}
+
+#endif /* _UTF8_H_ */
@@ -27,73 +27,134 @@
 
 #include <vector>
 #include <string>
+#include <memory>
 #include <cstring>
 #include <cstddef>
-
+#include <cstdlib>
+#include <new>
+
+#include "mapped_file.h"
+#include "file_table.h"
+#include "concurrent_queue.h"
+
+/**
+ * Chunk of input handed to the counting threads.
+ *
+ * A load owns a page aligned buffer, which is filled by the stream
+ * readers. Alternatively, it is a view into a memory mapped file. In the
+ * latter case the load holds a reference to the mapping and does not
+ * copy anything.
+ *
+ * Loads are recycled by the LoadPool, so the buffer is allocated once
+ * and reset() prepares the load for the next chunk.
+ *
+ * @prev is the character preceding the load in its file. It's required
+ * to detect words spanning multiple loads. @sequence numbers the loads of
+ * a file in the order they have been queued.
+ *
+ * Small files are packed into one load as a batch. Then every file is a
+ * segment of the buffer and file() as well as prev() are meaningless.
+ */
 template<typename T=wchar_t>
-class WordCountLoad
+class alignas(CACHE_LINE_SIZE) WordCountLoad
 {
 public:
-    WordCountLoad() :
-        m_data{nullptr},
+    static constexpr std::size_t BUFFER_ALIGNMENT = 4096;
+
+    struct Segment {
+        FileId file;
+        std::size_t offset;
+        std::size_t size;
+    };
+
+    explicit WordCountLoad(std::size_t capacity, std::size_t index = 0) :
+        m_buffer{allocate(capacity)},
+        m_capacity{capacity},
+        m_index{index},
+        m_data{m_buffer},
         m_size{0},
-        m_prev{L'a'}
+        m_file{0},
+        m_sequence{0},
+        m_prev{L' '}
     {}
 
-    WordCountLoad(std::size_t size, const std::string& file) :
-        m_data{new T[size]},
-        m_size{size},
-        m_file{file},
-        m_prev{L'a'}
-    {}
+    WordCountLoad(const WordCountLoad& other) = delete;
+    WordCountLoad& operator=(const WordCountLoad& other) = delete;
 
-    WordCountLoad(const WordCountLoad& other)
+    virtual ~WordCountLoad()
     {
-        if (other.m_data) {
-            m_data = new T[other.m_size];
-            std::memcpy(m_data, other.m_data, sizeof(T) * other.m_size);
-        } else
-            m_data = nullptr;
-        m_size = other.m_size;
-        m_file = other.m_file;
-        m_prev = other.m_prev;
+        std::free(m_buffer);
     }
 
-    WordCountLoad(WordCountLoad&& other)
+    /**
+     * Prepares the load for the next chunk of @file.
+     */
+    void reset(FileId file) noexcept
     {
-        m_data = other.m_data;
-        m_size = other.m_size;
-        m_file = std::move(other.m_file);
-        m_prev = other.m_prev;
+        m_data = m_buffer;
+        m_size = 0;
+        m_file = file;
+        m_sequence = 0;
+        m_prev = L' ';
+        m_map.reset();
+        m_segments.clear();
     }
 
-    virtual ~WordCountLoad()
+    /**
+     * Drops the reference to the mapping, if any.
+     */
+    void clear() noexcept
     {
-        delete[] m_data;
+        m_data = m_buffer;
+        m_size = 0;
+        m_map.reset();
+        m_segments.clear();
     }
 
-    auto& operator=(const WordCountLoad& other)
+    /**
+     * Turns the load into a view of @size bytes at @offset of @map.
+     */
+    void map(const std::shared_ptr<const MappedFile>& map, std::size_t offset,
+             std::size_t size)
     {
-        if (other.m_data) {
-            m_data = new T[other.m_size];
-            std::memcpy(m_data, other.m_data, sizeof(T) * other.m_size);
-        } else
-            m_data = nullptr;
-        m_size = other.m_size;
-        m_file = other.m_file;
-        m_prev = other.m_prev;
+        static_assert(sizeof(T) == 1, "Mapped loads operate on bytes");
 
-        return *this;
+        m_data = reinterpret_cast<const T *>(map->data() + offset);
+        m_size = size;
+        m_map = map;
     }
 
-    auto& operator=(WordCountLoad&& other)
+    /**
+     * Appends a whole file of @size elements, which has been written to
+     * the buffer right after the current data.
+     */
+    void add_segment(FileId file, std::size_t size)
     {
-        m_data = other.m_data;
-        m_size = other.m_size;
-        m_file = std::move(other.m_file);
-        m_prev = other.m_prev;
+        m_segments.push_back({file, m_size, size});
+        m_size += size;
+    }
 
-        return *this;
+    const std::vector<Segment>& segments() const noexcept
+    {
+        return m_segments;
+    }
+
+    /**
+     * Drops the first @count elements of the data.
+     */
+    void skip(std::size_t count) noexcept
+    {
+        m_data += count;
+        m_size -= count;
+    }
+
+    /**
+     * Appends @count elements to the data, which has to be in the buffer.
+     */
+    void append(const T *data, std::size_t count) noexcept
+    {
+        std::memcpy(m_buffer + (m_data - m_buffer) + m_size, data, count * sizeof(T));
+        m_size += count;
     }
 
     T operator[](std::size_t idx) const noexcept
@@ -101,9 +162,25 @@ public:
         return m_data[idx];
     }
 
-    T *data() noexcept
+    /**
+     * Writable storage of capacity() elements.
+     */
+    T *buffer() noexcept
     {
-        return m_data;
+        return m_buffer;
+    }
+
+    std::size_t capacity() const noexcept
+    {
+        return m_capacity;
+    }
+
+    /**
+     * Position of the load within its pool.
+     */
+    std::size_t index() const noexcept
+    {
+        return m_index;
     }
 
     const T *data() const noexcept
@@ -121,31 +198,58 @@ public:
         return m_size;
     }
 
-    const std::string& file() const noexcept
+    const FileId& file() const noexcept
     {
         return m_file;
     }
 
-    std::string& file() noexcept
+    FileId& file() noexcept
     {
         return m_file;
     }
 
-    const T& prev() const noexcept
+    const std::size_t& sequence() const noexcept
+    {
+        return m_sequence;
+    }
+
+    std::size_t& sequence() noexcept
+    {
+        return m_sequence;
+    }
+
+    const wchar_t& prev() const noexcept
     {
         return m_prev;
     }
 
-    T& prev() noexcept
+    wchar_t& prev() noexcept
     {
         return m_prev;
     }
 
 private:
-    T *m_data;
+    static T *allocate(std::size_t capacity)
+    {
+        auto bytes = (capacity * sizeof(T) + BUFFER_ALIGNMENT - 1) & ~(BUFFER_ALIGNMENT - 1);
+        auto buffer = std::aligned_alloc(BUFFER_ALIGNMENT, bytes ? bytes : BUFFER_ALIGNMENT);
+
+        if (!buffer)
+            throw std::bad_alloc();
+
+        return static_cast<T *>(buffer);
+    }
+
+    T *m_buffer;
+    std::size_t m_capacity;
+    std::size_t m_index;
+    const T *m_data;
     std::size_t m_size;
-    std::string m_file;
-    T m_prev;
+    FileId m_file;
+    std::size_t m_sequence;
+    wchar_t m_prev;
+    std::shared_ptr<const MappedFile> m_map;
+    std::vector<Segment> m_segments;
 };
 
 #endif /* _WORDCOUNT_LOAD_H_ */
@@ -25,22 +25,23 @@
 #ifndef _WORD_COUNT_RESULT_H_
 #define _WORD_COUNT_RESULT_H_
 
-#include <string>
 #include <cstddef>
 
+#include "file_table.h"
+
 class WordCountResult
 {
 public:
     WordCountResult() :
-        m_words{0}, m_lines{0}, m_chars{0}
+        m_file{0}, m_words{0}, m_lines{0}, m_chars{0}, m_bytes{0}, m_invalid{0}
     {}
 
-    const std::string& file() const noexcept
+    const FileId& file() const noexcept
     {
         return m_file;
     }
 
-    std::string& file() noexcept
+    FileId& file() noexcept
     {
         return m_file;
     }
@@ -75,19 +76,43 @@ public:
         return m_chars;
     }
 
+    const std::size_t& bytes() const noexcept
+    {
+        return m_bytes;
+    }
+
+    std::size_t& bytes() noexcept
+    {
+        return m_bytes;
+    }
+
+    const std::size_t& invalid() const noexcept
+    {
+        return m_invalid;
+    }
+
+    std::size_t& invalid() noexcept
+    {
+        return m_invalid;
+    }
+
     auto& operator+=(const WordCountResult& rhs) noexcept
     {
         m_words += rhs.m_words;
         m_lines += rhs.m_lines;
         m_chars += rhs.m_chars;
+        m_bytes += rhs.m_bytes;
+        m_invalid += rhs.m_invalid;
         return *this;
     }
 
 private:
-    std::string m_file;
+    FileId m_file;
     std::size_t m_words;
     std::size_t m_lines;
     std::size_t m_chars;
+    std::size_t m_bytes;
+    std::size_t m_invalid;
 };
 
 #endif /* _WORD_COUNT_RESULT_H_ */
@@ -25,138 +25,1787 @@
 #include <iostream>
 #include <sstream>
 #include <fstream>
-#include <iomanip>
 #include <thread>
+#include <locale>
+#include <variant>
+#include <algorithm>
+#include <array>
+#include <utility>
+#include <cwchar>
+#include <climits>
+#include <chrono>
+#include <mutex>
 
 #include <cstring>
+#include <cerrno>
+#include <fcntl.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
 #include "config.h"
 #include "logger.h"
 #include "word_counter.h"
+#include "utf8.h"
+#include "count_kernel.h"
+#include "file_watch.h"
+#include "thread_pool.h"
+#include "topology.h"
 
-void WordCounter::count_thread()
+using Clock = std::chrono::steady_clock;
+
+// size of the range which is read ahead of the mapped loads
+static constexpr std::size_t MAP_READ_AHEAD = 16 * 1024 * 1024;
+
+// compressed input read at once from pipes
+static constexpr std::size_t COMPRESSED_BUFFER = 1024 * 1024;
+
+// decompressed size of the units which are decompressed at once
+static constexpr std::size_t DECOMPRESS_WINDOW = 64 * 1024 * 1024;
+static constexpr std::size_t UNITS_PER_THREAD = 4;
+
+// reads in flight per file with io_uring
+static constexpr unsigned READ_DEPTH = 8;
+
+// loads a reader holds at once: every slot of the io_uring reader keeps
+// its load from submission until the chunks in front of it have been
+// completed, the last chunk waits for the carry of the next one and small
+// files are collected in a batch. The other readers only fill one load
+// next to the batch.
+static constexpr std::size_t URING_READER_LOADS = READ_DEPTH + 2;
+static constexpr std::size_t READER_LOADS = 2;
+
+// O_DIRECT requires aligned buffers, offsets and sizes
+static constexpr std::size_t DIRECT_ALIGNMENT = 4096;
+
+// pipe buffer size requested for piped input
+static constexpr int PIPE_SIZE = 1024 * 1024;
+
+// loads which may be queued per counting thread before the reader blocks
+static constexpr std::size_t QUEUED_LOADS_PER_THREAD = 8;
+static constexpr std::size_t MIN_QUEUED_LOADS = 64;
+
+// files a reader may be ahead of the next result due in ordered output
+static constexpr std::size_t REORDER_WINDOW = 64;
+
+// bytes read at once in follow mode
+static constexpr std::size_t FOLLOW_BUFFER = 64 * 1024;
+
+// part of the cache mask, counts depend on how the input is decoded
+static constexpr std::uint32_t CACHE_UTF8 = 1u << 31;
+
+static WordCountResult to_result(FileId file, const CountKernel::Counts& counts,
+                                 std::size_t bytes)
+{
+    WordCountResult result;
+
+    result.file()    = file;
+    result.bytes()   = bytes;
+    result.lines()   = counts.lines;
+    result.words()   = counts.words;
+    result.chars()   = counts.chars;
+    result.invalid() = counts.invalid;
+
+    return result;
+}
+
+static std::uint64_t to_ns(Clock::duration duration)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+}
+
+static std::uint64_t mtime_ns(const struct stat& st)
+{
+    return static_cast<std::uint64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+/**
+ * Whether the file starts with the magic bytes of a format, which this
+ * build can decompress. Doesn't change the file offset.
+ */
+static bool is_compressed(int fd)
+{
+    unsigned char magic[Decompressor::MAGIC_SIZE];
+    auto ret = ::pread(fd, magic, sizeof(magic), 0);
+
+    return ret > 0 && Decompressor::supported(Decompressor::detect(magic, ret));
+}
+
+static bool is_compressed(const std::string& file)
+{
+    int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    auto compressed = is_compressed(fd);
+    ::close(fd);
+
+    return compressed;
+}
+
+static void add(std::vector<WordCountResult>& results, const WordCountResult& res)
+{
+    if (res.file() >= results.size())
+        results.resize(res.file() + 1);
+    results[res.file()] += res;
+}
+
+std::size_t& WordCounter::next_sequence() noexcept
+{
+    static thread_local std::size_t sequence = 0;
+
+    return sequence;
+}
+
+/**
+ * Node of every counting thread, numbered in the order their CPUs are
+ * given. Without CPUs there is only one.
+ */
+static std::vector<std::size_t> worker_nodes(const KwcNGConfig& config)
+{
+    std::vector<std::size_t> nodes(std::max<std::size_t>(config.max_threads, 1), 0);
+    std::vector<unsigned> seen;
+
+    for (std::size_t i = 0; !config.cpus.empty() && i < nodes.size(); ++i) {
+        auto node = Topology::node_of(config.cpus[i % config.cpus.size()]);
+        auto it = std::find(seen.begin(), seen.end(), node);
+
+        nodes[i] = it - seen.begin();
+        if (it == seen.end())
+            seen.push_back(node);
+    }
+
+    return nodes;
+}
+
+static std::size_t node_workers(const std::vector<std::size_t>& nodes, std::size_t node)
+{
+    return std::count(nodes.begin(), nodes.end(), node);
+}
+
+std::size_t WordCounter::place(std::size_t worker)
+{
+    if (m_config.cpus.empty() || worker >= m_worker_nodes.size())
+        return 0;
+
+    const auto cpu = m_config.cpus[worker % m_config.cpus.size()];
+    const auto node = m_worker_nodes[worker];
+
+    if (!Topology::pin(cpu))
+        std::call_once(m_pin_warning, [cpu] {
+            log_warn("Failed to pin the counting threads, e.g. to CPU " << cpu);
+        });
+
+    // the buffers are placed where they're written first, so this
+    // thread's share of the queue is created here instead of by a reader
+    m_byte_pools[node]->prefill(QUEUED_LOADS_PER_THREAD + 1);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (++m_placed == m_config.max_threads)
+        m_placed_cv.notify_all();
+
+    return node;
+}
+
+WordCounter::Work WordCounter::pop(std::size_t node)
+{
+    Work work;
+
+    if (m_queues.size() == 1)
+        return m_queues[0]->pop();
+
+    // chunks on the own node come first, idle threads help the others
+    for (std::size_t i = 0; i < m_queues.size(); ++i)
+        if (m_queues[(node + i) % m_queues.size()]->try_pop(work))
+            return work;
+
+    // zZz
+    return m_queues[node]->pop();
+}
+
+std::unique_ptr<WordCounter::ByteLoad> WordCounter::get_byte_load()
+{
+    std::unique_ptr<ByteLoad> load;
+
+    if (m_byte_pools.size() == 1)
+        return m_byte_pools[0]->get();
+
+    // the chunks are spread over the nodes, a full node is skipped
+    const auto first = m_next_node++ % m_byte_pools.size();
+    for (std::size_t i = 0; i < m_byte_pools.size(); ++i)
+        if (m_byte_pools[(first + i) % m_byte_pools.size()]->try_get(load))
+            return load;
+
+    // zZz
+    return m_byte_pools[first]->get();
+}
+
+void WordCounter::count_thread(std::size_t worker)
+{
+    const auto node = place(worker);
+
+    // accumulated locally, the shared results are only touched once at the end
+    std::vector<ResultSlot> results;
+    std::vector<RangeEdges> edges;
+
+    // only measured if the chunk size is adapted
+    const auto adapt = static_cast<bool>(m_config.flags & KwcNGOpt::AUTO_CHUNK_SIZE);
+    const auto timed = adapt || m_stats.enabled();
+    const auto freq = static_cast<bool>(m_config.flags & KwcNGOpt::FREQ);
+    ChunkSizer::Sample sample;
+    PipelineStats::WorkerStats stats;
+    WordFrequencies::Local words;
+
+    // streamed results are complete once the file's last load has been counted
+    auto sink = [&] (const WordCountResult& result) {
+        if (m_streaming)
+            m_stream.release(result);
+        else
+            accumulate(results, result);
+    };
+
+    if (m_config.flags & KwcNGOpt::STEAL) {
+        auto start = timed ? Clock::now() : Clock::time_point{};
+
+        count_ranges(worker, results, edges);
+        if (timed)
+            stats.busy_ns += to_ns(Clock::now() - start);
+    }
+
+    while (1) {
+        auto waiting = timed ? Clock::now() : Clock::time_point{};
+        std::size_t bytes = 0;
+
+        // zZz
+        auto work = pop(node);
+
+        auto counting = timed ? Clock::now() : Clock::time_point{};
+
+        auto valid = std::visit([&] (auto&& load) {
+                                    if (!load)
+                                        return false;
+                                    bytes = load->size() * sizeof(*load->data());
+                                    count(*load, sink);
+                                    if constexpr (std::is_same_v<std::decay_t<decltype(*load)>,
+                                                                 ByteLoad>)
+                                        if (freq)
+                                            tokenize(*load, words);
+                                    m_inflight.release(bytes);
+                                    put_load(std::move(load));
+                                    return true;
+                                }, work);
+        if (!valid) {
+            stats.idle_ns += to_ns(counting - waiting);
+            break;
+        }
+
+        if (!timed)
+            continue;
+
+        const auto wait_ns = to_ns(counting - waiting);
+        const auto count_ns = to_ns(Clock::now() - counting);
+
+        stats.idle_ns += wait_ns;
+        stats.busy_ns += count_ns;
+        stats.chunks++;
+        stats.bytes += bytes;
+
+        if (!adapt)
+            continue;
+
+        sample.wait_ns += wait_ns;
+        sample.count_ns += count_ns;
+        if (++sample.chunks == ChunkSizer::SAMPLES) {
+            m_sizer.report(sample);
+            sample = ChunkSizer::Sample{};
+        }
+    }
+
+    if (m_stats.enabled())
+        m_stats.add_worker(stats);
+    if (freq)
+        m_freq.add(std::move(words));
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (results.size() > m_results.size())
+        m_results.resize(results.size());
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        m_results[i] += results[i].result;
+        m_global += results[i].result;
+    }
+    m_edges.insert(m_edges.end(), edges.begin(), edges.end());
+
+    if (++m_finished != m_config.max_threads)
+        return;
+
+    join_ranges();
+}
+
+void WordCounter::count_ranges(std::size_t worker, std::vector<ResultSlot>& results,
+                               std::vector<RangeEdges>& edges)
+{
+    Range range;
+
+    m_scheduler.wait_sealed();
+
+    while (m_scheduler.next(worker, range)) {
+        const auto& map = m_maps[range.file];
+        auto data = reinterpret_cast<const unsigned char *>(map->data());
+        auto begin = Utf8::align(data, range.begin, map->size());
+        auto end = Utf8::align(data, range.end, map->size());
+        CountKernel::Counts counts;
+
+        if (begin >= end)
+            continue;
+
+        // consecutive chunks are merged right away, the other ones afterwards
+        auto continued = !edges.empty() && edges.back().file == range.file &&
+            edges.back().end == begin;
+        if (!continued)
+            edges.push_back({range.file, begin, begin,
+                             !Utf8::is_space(data + begin, data + map->size()), false});
+
+        auto& edge = edges.back();
+        bool prev_space = !edge.ends_in_word;
+
+        m_count_bytes(data + begin, end - begin, prev_space, counts);
+
+        edge.end = end;
+        edge.ends_in_word = !prev_space;
+        accumulate(results, to_result(range.file, counts, end - begin));
+    }
+}
+
+void WordCounter::accumulate(std::vector<ResultSlot>& results, const WordCountResult& result)
+{
+    if (result.file() >= results.size())
+        results.resize(result.file() + 1);
+    results[result.file()].result += result;
+}
+
+void WordCounter::join_ranges()
+{
+    if (!(m_config.flags & KwcNGOpt::WORDS)) {
+        m_edges.clear();
+        m_maps.clear();
+        return;
+    }
+
+    // ranges have been counted as if preceded by whitespace, so words
+    // spanning two adjacent ranges have been counted twice
+    std::sort(m_edges.begin(), m_edges.end(), [] (const auto& a, const auto& b) {
+        return a.file < b.file || (a.file == b.file && a.begin < b.begin);
+    });
+
+    for (std::size_t i = 1; i < m_edges.size(); ++i) {
+        const auto& prev = m_edges[i - 1];
+        const auto& cur = m_edges[i];
+
+        if (prev.file != cur.file || prev.end != cur.begin ||
+            !prev.ends_in_word || !cur.starts_in_word)
+            continue;
+
+        m_results[cur.file].words()--;
+        m_global.words()--;
+    }
+
+    m_edges.clear();
+    m_maps.clear();
+}
+
+template<std::uint32_t Metrics>
+static void count_wide(const wchar_t *data, std::size_t size, bool& prev_space,
+                       CountKernel::Counts& counts)
+{
+    constexpr bool lines = Metrics & CountKernel::LINES;
+    constexpr bool words = Metrics & CountKernel::WORDS;
+    const auto end = data + size;
+
+    // the stream has decoded the characters already
+    if constexpr (Metrics & CountKernel::CHARS)
+        counts.chars += size;
+
+    if constexpr (lines && !words) {
+        for (auto p = data; (p = std::wmemchr(p, L'\n', end - p)); ++p)
+            counts.lines++;
+        return;
+    }
+
+    if constexpr (words) {
+        for (auto p = data; p < end; ++p) {
+            bool space = std::iswspace(*p);
+
+            if constexpr (lines)
+                counts.lines += *p == L'\n';
+
+            counts.words += !space && prev_space;
+            prev_space = space;
+        }
+    }
+}
+
+template<std::size_t... Metrics>
+static constexpr auto make_wide_variants(std::index_sequence<Metrics...>)
+{
+    return std::array<WordCounter::WideCount, CountKernel::VARIANTS>{
+        count_wide<Metrics>...
+    };
+}
+
+static std::uint32_t requested_metrics(const KwcNGConfig& config)
+{
+    std::uint32_t metrics = 0;
+
+    if (config.flags & KwcNGOpt::LINES)
+        metrics |= CountKernel::LINES;
+    if (config.flags & KwcNGOpt::WORDS)
+        metrics |= CountKernel::WORDS;
+    if (config.flags & KwcNGOpt::CHARS)
+        metrics |= CountKernel::CHARS;
+    if (config.flags & KwcNGOpt::VALIDATE)
+        metrics |= CountKernel::VALIDATE;
+
+    return metrics;
+}
+
+WordCounter::WordCounter(const KwcNGConfig& config) :
+    m_config{config},
+    m_worker_nodes{worker_nodes(config)},
+    m_queue_capacity{std::max(config.max_threads * QUEUED_LOADS_PER_THREAD, MIN_QUEUED_LOADS)},
+    // loads in the queue, being counted and being filled, per node
+    m_node_loads{m_queue_capacity + config.max_threads + config.max_readers *
+                 (config.flags & KwcNGOpt::IO_URING ? URING_READER_LOADS : READER_LOADS)},
+    m_inflight{config.max_inflight_bytes},
+    m_wide_pool{m_queue_capacity + config.max_threads + config.max_readers,
+                config.chunk_size},
+    m_walker{m_files},
+    m_scheduler{config.max_threads, config.chunk_size},
+    m_sizer{config.chunk_size},
+    m_cache{config.cache_file.empty() ? nullptr : std::make_unique<CountCache>(config.cache_file)},
+    m_cache_mask{0},
+    m_stats{static_cast<bool>(config.flags & KwcNGOpt::STATS)},
+    m_freq{config.max_threads},
+    // the ranges are only corrected once all threads are done
+    m_streaming{(config.flags & KwcNGOpt::STREAM) && !(config.flags & KwcNGOpt::STEAL)},
+    m_keep_results{!m_streaming || m_cache || (config.flags & KwcNGOpt::FOLLOW)},
+    m_output{nullptr},
+    m_stream{static_cast<bool>(config.flags & KwcNGOpt::ORDERED),
+             std::max(REORDER_WINDOW, 2 * config.max_readers),
+             [this] (const WordCountResult& result) { emit(result); }},
+    m_next_node{0},
+    m_finished{0},
+    m_placed{0},
+    // the caller of run() reads, the pool's own threads count
+    m_pool{config.max_threads + 1},
+    m_buffers{config, m_pool}
+{
+    static constexpr auto wide_variants =
+        make_wide_variants(std::make_index_sequence<CountKernel::VARIANTS>());
+    auto metrics = requested_metrics(config);
+    const auto nodes = *std::max_element(m_worker_nodes.begin(), m_worker_nodes.end()) + 1;
+
+    // each node has a pool and a queue of its own, sized for its threads
+    for (std::size_t node = 0; node < nodes; ++node) {
+        const auto workers = node_workers(m_worker_nodes, node);
+        const auto capacity = std::max(workers * QUEUED_LOADS_PER_THREAD, MIN_QUEUED_LOADS);
+
+        m_queues.push_back(std::make_unique<ConcurrentQueue<Work>>(capacity));
+        m_byte_pools.push_back(std::make_unique<LoadPool<ByteLoad>>(
+            m_node_loads, config.chunk_size + Utf8::MAX_CARRY, node * m_node_loads));
+    }
+
+    // dispatch once, the variants only contain what's requested
+    m_count_bytes = CountKernel::get().variant(metrics);
+    m_count_wide = wide_variants[metrics];
+
+    m_cache_mask = metrics | (Utf8::locale_is_utf8() ? CACHE_UTF8 : 0);
+    if (m_cache && m_cache->corrupt())
+        log_warn("Ignoring invalid cache file " << config.cache_file);
+}
+
+template<typename Sink>
+void WordCounter::count(const ByteLoad& load, Sink&& sink) const
+{
+    auto data = reinterpret_cast<const unsigned char *>(load.data());
+
+    if (load.segments().empty()) {
+        CountKernel::Counts counts;
+        bool prev_space = std::iswspace(load.prev());
+
+        m_count_bytes(data, load.size(), prev_space, counts);
+        sink(to_result(load.file(), counts, load.size()));
+        return;
+    }
+
+    // batch of whole files
+    for (auto&& segment: load.segments()) {
+        CountKernel::Counts counts;
+        bool prev_space = true;
+
+        m_count_bytes(data + segment.offset, segment.size, prev_space, counts);
+        sink(to_result(segment.file, counts, segment.size));
+    }
+}
+
+/**
+ * The streams have decoded the characters already, so the bytes have to
+ * be counted by encoding them again. Only done if requested.
+ */
+std::size_t WordCounter::encoded_size(const WideLoad& load) const
+{
+    char buffer[MB_LEN_MAX];
+    std::mbstate_t state{};
+    std::size_t bytes = 0;
+
+    if (!(m_config.flags & KwcNGOpt::BYTES))
+        return 0;
+
+    for (std::size_t i = 0; i < load.size(); ++i) {
+        auto len = std::wcrtomb(buffer, load.data()[i], &state);
+
+        bytes += len == static_cast<std::size_t>(-1) ? 1 : len;
+    }
+
+    return bytes;
+}
+
+void WordCounter::tokenize(const ByteLoad& load, WordFrequencies::Local& local) const
+{
+    auto data = reinterpret_cast<const unsigned char *>(load.data());
+
+    if (load.segments().empty()) {
+        WordFrequencies::tokenize(data, load.size(), load.file(), load.sequence(), false, local);
+        return;
+    }
+
+    for (auto&& segment: load.segments())
+        WordFrequencies::tokenize(data + segment.offset, segment.size, segment.file, 0, true,
+                                  local);
+}
+
+template<typename Sink>
+void WordCounter::count(const WideLoad& load, Sink&& sink) const
+{
+    CountKernel::Counts counts;
+    bool prev_space = std::iswspace(load.prev());
+
+    m_count_wide(load.data(), load.size(), prev_space, counts);
+    sink(to_result(load.file(), counts, encoded_size(load)));
+}
+
+void WordCounter::run(const Files& files, Output& output)
+{
+    // the loads, the chunk size and the cache are kept, the rest belongs
+    // to the previous run
+    m_files.reset();
+    m_walker.reset();
+    m_scheduler.reset();
+    for (auto&& queue: m_queues)
+        queue->reset();
+    m_results.clear();
+    m_global = WordCountResult{};
+    m_cache_records.clear();
+    m_finished = 0;
+    m_placed = 0;
+    m_output = &output;
+
+    // the calling thread takes the first task and reads, every other
+    // task is a counting thread
+    m_pool.run(m_config.max_threads + 1, [&] (std::size_t task) {
+        if (task) {
+            count_thread(task - 1);
+            return;
+        }
+
+        distribute_work(files);
+        stop();
+    });
+
+    // the counting threads are done, so the pool is free to merge
+    if (m_config.flags & KwcNGOpt::FREQ)
+        m_freq.merge(m_pool, m_config.top);
+
+    save_cache();
+    report(output);
+}
+
+void WordCounter::distribute_work(const Files& files)
+{
+    // the byte kernels require UTF-8, everything else is decoded by the streams
+    const auto utf8 = Utf8::locale_is_utf8();
+    const auto freq = static_cast<bool>(m_config.flags & KwcNGOpt::FREQ);
+    // the ranges aren't ordered, words crossing them cannot be stitched
+    const auto steal = utf8 && !freq && (m_config.flags & KwcNGOpt::STEAL) &&
+        (m_config.flags & (KwcNGOpt::LINES | KwcNGOpt::WORDS | KwcNGOpt::CHARS));
+    std::vector<std::thread> readers, walkers;
+    auto walk = false;
+
+    // readers would create the loads on their own node otherwise
+    if (!m_config.cpus.empty()) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        // zZz
+        m_placed_cv.wait(lock, [&] { return m_placed >= m_config.max_threads; });
+    }
+
+    m_stats.start();
+
+    if (freq && !utf8)
+        log_warn("Word frequencies require a UTF-8 locale");
+
+    // the loads only carry ids, files found by the walkers get theirs later
+    for (auto&& file: files) {
+        struct stat st;
+
+        if ((m_config.flags & KwcNGOpt::RECURSIVE) && file != "stdin" &&
+            !::stat(file.c_str(), &st) && S_ISDIR(st.st_mode)) {
+            m_walker.add(file);
+            walk = true;
+        } else
+            m_files.add(file);
+    }
+
+    m_maps.resize(m_files.size());
+
+    // regular files are split into ranges, which the counting threads
+    // claim and count on their own
+    for (FileId file = 0; steal && file < m_files.size(); ++file) {
+        const auto& name = m_files.name(file);
+
+        m_maps[file] = name == "stdin" ?
+            MappedFile::map(STDIN_FILENO) : MappedFile::map(name);
+
+        // compressed files are left to the readers, which decompress them
+        if (m_maps[file] &&
+            compression(reinterpret_cast<const unsigned char *>(m_maps[file]->data()),
+                        m_maps[file]->size()) != Decompressor::Format::NONE)
+            m_maps[file] = nullptr;
+
+        if (m_maps[file]) {
+            m_scheduler.add({file, 0, m_maps[file]->size()});
+            m_files.bytes(file) = m_maps[file]->size();
+        }
+    }
+    m_scheduler.seal();
+
+    // directories are walked while the files found so far are read
+    if (walk) {
+        walkers.reserve(m_config.max_readers);
+        for (auto i = 0u; i < m_config.max_readers; ++i)
+            walkers.emplace_back(&DirWalker::walk, &m_walker);
+    } else
+        m_files.close();
+
+    // everything else goes through the queue, several files at once
+    readers.reserve(m_config.max_readers - 1);
+    for (auto i = 1u; i < m_config.max_readers; ++i)
+        readers.emplace_back(&WordCounter::read_files, this, utf8);
+    read_files(utf8);
+    for (auto&& reader: readers)
+        reader.join();
+    for (auto&& walker: walkers)
+        walker.join();
+
+    for (auto&& error: m_walker.errors()) {
+        errno = error.second;
+        log_err("Failed to read directory " << error.first);
+    }
+
+    // reported afterwards, so that the readers don't interleave their output
+    for (FileId file = 0; file < m_files.size(); ++file) {
+        const auto& name = m_files.name(file);
+
+        if (m_files.open_error(file)) {
+            errno = m_files.open_error(file);
+            log_err("Failed to open file " << name);
+        }
+        if (m_files.read_error(file)) {
+            errno = m_files.read_error(file);
+            log_err("Failed to read from file " << name);
+            log_info("Counting results for file " << name << " will be incorrect");
+        }
+    }
+}
+
+void WordCounter::read_files(bool utf8)
+{
+    const auto started = m_stats.enabled() ? Clock::now() : Clock::time_point{};
+    // validation has to read the data just like the other metrics
+    const auto metadata = !requested_metrics(m_config) && !(m_config.flags & KwcNGOpt::FREQ);
+    std::unique_ptr<ByteLoad> batch;
+#ifdef KWCNG_IO_URING
+    std::unique_ptr<IoRing> ring;
+
+    if (utf8 && (m_config.flags & KwcNGOpt::IO_URING))
+        ring = IoRing::create(READ_DEPTH, m_node_loads * m_byte_pools.size());
+    if (utf8 && (m_config.flags & KwcNGOpt::IO_URING) && !ring)
+#else
+    if (utf8 && (m_config.flags & KwcNGOpt::IO_URING))
+#endif
+        std::call_once(m_uring_warning, [] {
+            log_warn("io_uring is not available, falling back to the default readers");
+        });
+
+    auto read_file = [&] (FileId file) {
+        const auto& name = m_files.name(file);
+        struct stat st;
+
+        if (file < m_maps.size() && m_maps[file])
+            return;
+
+        // directories are only walked with --recursive, reading them fails
+        const auto stated = name != "stdin" && !::stat(name.c_str(), &st);
+        if (stated && S_ISDIR(st.st_mode)) {
+            m_files.open_error(file) = EISDIR;
+            return;
+        }
+
+        // only the size is requested, which regular files know without reading
+        if (metadata && name != "stdin" && from_metadata(file))
+            return;
+
+        // the cache doesn't know the words
+        if (m_cache && !(m_config.flags & KwcNGOpt::FREQ) && name != "stdin" &&
+            cached(file, utf8, batch))
+            return;
+
+        if (!utf8) {
+            distribute_stream(file);
+            return;
+        }
+
+        if (stated && S_ISREG(st.st_mode) && st.st_size > 0 &&
+            static_cast<std::size_t>(st.st_size) < m_config.chunk_size) {
+            batch_file(file, st.st_size, batch);
+            return;
+        }
+
+        // the batched files are done, their results shouldn't wait for this one
+        if (m_streaming && batch && !batch->segments().empty())
+            push(std::move(batch));
+
+#ifdef KWCNG_IO_URING
+        if (ring && name != "stdin" && !is_compressed(name) && distribute_uring(file, *ring))
+            return;
+#endif
+
+        auto map = name == "stdin" ?
+            MappedFile::map(STDIN_FILENO) : MappedFile::map(name);
+        auto format = map ?
+            compression(reinterpret_cast<const unsigned char *>(map->data()), map->size()) :
+            Decompressor::Format::NONE;
+
+        if (format != Decompressor::Format::NONE)
+            distribute_compressed(file, map, format);
+        else if (map)
+            distribute_mapped(file, map);
+        else
+            distribute_bytes(file);
+    };
+
+    // files are claimed as a whole, so their loads are queued in order
+    for (FileId file; m_files.claim(file); ) {
+        next_sequence() = 0;
+
+        if (!m_streaming) {
+            read_file(file);
+            continue;
+        }
+
+        // the batch may hold the files the reorder window is waiting for
+        if (!m_stream.fits(file) && batch && !batch->segments().empty())
+            push(std::move(batch));
+        m_stream.wait(file);
+
+        // the reader's reference keeps the result until all loads are queued
+        m_stream.open(file);
+        read_file(file);
+        m_stream.close(file);
+    }
+
+    if (batch && !batch->segments().empty())
+        push(std::move(batch));
+    else if (batch)
+        put_load(std::move(batch));
+
+    if (m_stats.enabled()) {
+        PipelineStats::reader().busy_ns += to_ns(Clock::now() - started);
+        m_stats.add_reader();
+    }
+}
+
+/**
+ * Looks up the counts of a file. Unless they can be used as they are, the
+ * file is counted right away from the descriptor which has been looked
+ * up, so that the stored record describes exactly what has been counted.
+ */
+bool WordCounter::cached(FileId file, bool utf8, std::unique_ptr<ByteLoad>& batch)
+{
+    const auto& name = m_files.name(file);
+    CountCache::Record record{};
+    auto handled = false, read = false;
+    struct stat st;
+
+    // errors are left to the readers, which report them
+    int fd = ::open(name.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    // the counts would have to be keyed by the decompressed content
+    if (::fstat(fd, &st) || !S_ISREG(st.st_mode) || is_compressed(fd)) {
+        ::close(fd);
+        return false;
+    }
+
+    record.dev       = st.st_dev;
+    record.ino       = st.st_ino;
+    record.size      = st.st_size;
+    record.mtime_ns  = mtime_ns(st);
+    record.mask      = m_cache_mask;
+    record.tail_hash = CountCache::tail_hash(fd, record.size);
+
+    auto hit = m_cache->find(record.dev, record.ino, record.mask);
+
+    if (hit && hit->size == record.size && hit->mtime_ns == record.mtime_ns &&
+        hit->tail_hash == record.tail_hash) {
+        add_cached(file, *hit);
+        m_files.bytes(file) = hit->size;
+        handled = true;
+    } else if (utf8 && hit && hit->size && hit->size < record.size &&
+               CountCache::tail_hash(fd, hit->size) == hit->tail_hash) {
+        // appended to, only the tail has to be counted
+        auto map = MappedFile::map(fd);
+        auto data = map ? reinterpret_cast<const unsigned char *>(map->data()) : nullptr;
+
+        if (map && Utf8::align(data, hit->size, map->size()) == hit->size) {
+            add_cached(file, *hit);
+            distribute_mapped(file, map, hit->size);
+            read = handled = true;
+        }
+    }
+
+    // the file may grow or be replaced until it's opened again by name
+    if (!handled && utf8 && record.size && record.size < m_config.chunk_size) {
+        batch_file(file, record.size, batch, fd);
+        read = handled = true;
+    } else if (!handled && utf8) {
+        if (auto map = MappedFile::map(fd)) {
+            if (m_streaming && batch && !batch->segments().empty())
+                push(std::move(batch));
+            distribute_mapped(file, map);
+            read = handled = true;
+        }
+    }
+
+    // the counts cover as many bytes as have been read, which differs
+    // from the size looked up if the file has been written to meanwhile
+    if (read) {
+        record.size = m_files.bytes(file);
+        record.tail_hash = CountCache::tail_hash(fd, record.size);
+    }
+
+    ::close(fd);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_cache_records.push_back({file, record, handled});
+
+    return handled;
+}
+
+void WordCounter::add_cached(FileId file, const CountCache::Record& record)
+{
+    WordCountResult result;
+
+    result.file()    = file;
+    result.bytes()   = record.size;
+    result.lines()   = record.lines;
+    result.words()   = record.words;
+    result.chars()   = record.chars;
+    result.invalid() = record.invalid;
+
+    add_result(result);
+}
+
+void WordCounter::add_result(const WordCountResult& result)
 {
-    while (1) {
-        // zZz
-        auto load = m_queue.pop();
+    if (m_streaming) {
+        m_stream.add(result);
+        return;
+    }
 
-        if (!load)
-            break;
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    add(m_results, result);
+    m_global += result;
+}
+
+bool WordCounter::from_metadata(FileId file)
+{
+    WordCountResult result;
+    struct stat st;
+
+    // errors are left to the readers, which report them, compressed
+    // files have to be decompressed
+    if (::stat(m_files.name(file).c_str(), &st) || !S_ISREG(st.st_mode) ||
+        is_compressed(m_files.name(file)))
+        return false;
+
+    result.file() = file;
+    result.bytes() = st.st_size;
+    m_files.bytes(file) = st.st_size;
+    add_result(result);
+
+    return true;
+}
+
+void WordCounter::save_cache()
+{
+    // a run which didn't look anything up, such as one counting word
+    // frequencies, would drop all records
+    if (!m_cache || m_cache_records.empty())
+        return;
+
+    for (auto&& entry: m_cache_records) {
+        auto file = entry.file;
+        auto& record = entry.record;
+        struct stat st;
+
+        if (m_files.open_error(file) || m_files.read_error(file))
+            continue;
+
+        // files read by name must not have changed since they were looked up
+        if (!entry.counted &&
+            (::stat(m_files.name(file).c_str(), &st) || st.st_dev != record.dev ||
+             st.st_ino != record.ino || static_cast<std::uint64_t>(st.st_size) != record.size ||
+             mtime_ns(st) != record.mtime_ns))
+            continue;
 
-        auto res = count(*load);
-        {
-            std::lock_guard<std::mutex> lock(m_mutex);
+        if (file < m_results.size()) {
+            const auto& result = m_results[file];
 
-            m_results[res.file()] += res;
-            m_global += res;
+            record.lines   = result.lines();
+            record.words   = result.words();
+            record.chars   = result.chars();
+            record.invalid = result.invalid();
         }
+        m_cache->store(record);
     }
+
+    if (!m_cache->save())
+        log_err("Failed to write cache file " << m_config.cache_file);
+
+    // the next run looks up the records of this one
+    m_cache = std::make_unique<CountCache>(m_config.cache_file);
 }
 
-WordCountResult WordCounter::count(const WordCountLoad<>& load) const
+#ifdef KWCNG_IO_URING
+bool WordCounter::distribute_uring(FileId file, IoRing& ring)
 {
-    WordCountResult result;
-    auto prev = load.prev();
+    struct Slot {
+        std::unique_ptr<ByteLoad> load;
+        std::size_t offset;
+        std::size_t filled;
+        std::size_t expected;
+        bool done;
+    };
 
-    result.file()  = load.file();
-    result.chars() = load.size();
+    const auto& name = m_files.name(file);
+    auto direct = (m_config.flags & KwcNGOpt::DIRECT) && m_config.chunk_size >= DIRECT_ALIGNMENT;
+    const auto read_size = direct ?
+        m_config.chunk_size & ~(DIRECT_ALIGNMENT - 1) : m_config.chunk_size;
+    std::array<Slot, READ_DEPTH> slots;
+    std::unique_ptr<ByteLoad> pending;
+    std::size_t submitted = 0, consumed = 0, inflight = 0, appended = 0;
+    auto prev = L' ';
+    int error = 0;
+    struct stat st;
 
-    for (std::size_t i = 0; i < load.size(); ++i) {
-        if ((config.flags & KwcNGOpt::LINES) && load[i] == L'\n')
-            result.lines()++;
+    int fd = ::open(name.c_str(), O_RDONLY | O_CLOEXEC | (direct ? O_DIRECT : 0));
+    if (fd < 0 && direct && errno == EINVAL) {
+        // file system without O_DIRECT support
+        direct = false;
+        fd = ::open(name.c_str(), O_RDONLY | O_CLOEXEC);
+    }
+    if (fd < 0) {
+        m_files.open_error(file) = errno;
+        return true;
+    }
+    if (::fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+        ::close(fd);
+        return false;
+    }
+
+    const std::size_t size = st.st_size;
+    const auto chunks = (size + read_size - 1) / read_size;
+
+    auto read = [&] (Slot& slot, std::size_t tag) {
+        auto load = slot.load.get();
+        int index = ring.register_buffer(load->index(), load->buffer(), load->capacity()) ?
+            load->index() : -1;
+
+        // the slots never exceed the ring size
+        ring.read(fd, load->buffer() + slot.filled, read_size - slot.filled,
+                  slot.offset + slot.filled, tag, index);
+        inflight++;
+    };
+
+    // the continuation bytes a chunk starts with complete the character at
+    // the end of the previous chunk, move them over
+    auto enqueue = [&] (std::unique_ptr<ByteLoad>&& load) {
+        if (pending) {
+            auto data = reinterpret_cast<const unsigned char *>(load->data());
+            std::size_t moved = 0;
+
+            while (appended + moved < Utf8::MAX_CARRY && moved < load->size() &&
+                   Utf8::is_continuation(data[moved]))
+                moved++;
+            pending->append(load->data(), moved);
+            load->skip(moved);
+            appended += moved;
+
+            // tiny chunks may consist of continuation bytes only
+            if (!load->size()) {
+                put_load(std::move(load));
+                return;
+            }
+
+            data = reinterpret_cast<const unsigned char *>(pending->data());
+            pending->prev() = prev;
+            prev = Utf8::prev_char(data, data + pending->size());
+            push(std::move(pending));
+        }
+        pending = std::move(load);
+        appended = 0;
+    };
+
+    while (consumed < chunks) {
+        IoRing::Completion completion;
+
+        while (!error && submitted < chunks && submitted - consumed < READ_DEPTH) {
+            auto& slot = slots[submitted % READ_DEPTH];
+
+            slot.load     = get_load<ByteLoad>(file);
+            slot.offset   = submitted * read_size;
+            slot.filled   = 0;
+            slot.expected = std::min(read_size, size - slot.offset);
+            slot.done     = false;
+            read(slot, submitted++);
+        }
+
+        if (auto ret = ring.submit(1); ret < 0) {
+            // the kernel might still write to the buffers, leave them alone
+            m_files.read_error(file) = -ret;
+            for (; consumed < submitted; ++consumed)
+                slots[consumed % READ_DEPTH].load.release();
+            pending.reset();
+            ::close(fd);
+            return true;
+        }
+
+        while (ring.reap(completion)) {
+            auto& slot = slots[completion.tag % READ_DEPTH];
+
+            inflight--;
+            if (completion.res < 0) {
+                error = -completion.res;
+                slot.done = true;
+                continue;
+            }
+
+            // short reads are continued, the end of file finishes the chunk
+            slot.filled += completion.res;
+            if (completion.res && slot.filled < slot.expected)
+                read(slot, completion.tag);
+            else
+                slot.done = true;
+        }
+
+        // loads are queued in file order
+        for (; consumed < submitted && slots[consumed % READ_DEPTH].done; ++consumed) {
+            auto& slot = slots[consumed % READ_DEPTH];
+
+            slot.load->size() = std::min(slot.filled, slot.expected);
+            m_files.bytes(file) += slot.load->size();
+            if (error)
+                put_load(std::move(slot.load));
+            else
+                enqueue(std::move(slot.load));
+        }
+
+        if (error && !inflight)
+            break;
+    }
+
+    ::close(fd);
+
+    if (error)
+        m_files.read_error(file) = error;
+
+    if (pending && pending->size() && !error) {
+        pending->prev() = prev;
+        push(std::move(pending));
+    } else if (pending)
+        put_load(std::move(pending));
+
+    return true;
+}
+#endif
 
-        if (!(config.flags & KwcNGOpt::WORDS))
+void WordCounter::batch_file(FileId file, std::size_t size, std::unique_ptr<ByteLoad>& batch,
+                             int fd)
+{
+    const auto& name = m_files.name(file);
+    // the cache hands over the file it has looked up
+    const auto owned = fd < 0;
+    std::size_t done = 0;
+
+    if (batch && batch->capacity() - batch->size() < size) {
+        push(std::move(batch));
+    }
+    if (!batch)
+        batch = get_load<ByteLoad>(file);
+
+    if (owned)
+        fd = ::open(name.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        m_files.open_error(file) = errno;
+        return;
+    }
+
+    // a file shrinking in the meantime ends early, one growing is cut off
+    auto buffer = batch->buffer() + batch->size();
+    while (done < size) {
+        auto ret = ::read(fd, buffer + done, size - done);
+
+        if (ret < 0 && errno == EINTR)
             continue;
+        if (ret < 0)
+            m_files.read_error(file) = errno;
+        if (ret <= 0)
+            break;
+        done += ret;
+    }
 
-        if (std::iswspace(load[i]) && !std::iswspace(prev))
-            result.words()++;
+    // the decompressed input may be way larger, so it isn't batched
+    auto format = compression(reinterpret_cast<unsigned char *>(buffer), done);
+    auto map = format != Decompressor::Format::NONE ? MappedFile::map(fd) : nullptr;
 
-        prev = load[i];
+    if (owned)
+        ::close(fd);
+
+    if (map) {
+        distribute_compressed(file, map, format);
+        return;
     }
 
-    if ((config.flags & KwcNGOpt::WORDS) &&
-        load.size() != config.chunk_size &&
-        !std::iswspace(prev))
-        result.words()++;
+    batch->add_segment(file, done);
+    m_files.bytes(file) = done;
+    if (m_streaming)
+        m_stream.ref(file);
+}
 
-    return result;
+void WordCounter::distribute_mapped(
+    FileId file, const std::shared_ptr<const MappedFile>& map, std::size_t start)
+{
+    auto data = reinterpret_cast<const unsigned char *>(map->data());
+
+    push_mapped(file, map, start, map->size(), Utf8::prev_char(data, data + start));
+    m_files.bytes(file) = map->size();
 }
 
-void WordCounter::distribute_work(const Files& files)
+void WordCounter::push_mapped(FileId file, const std::shared_ptr<const MappedFile>& map,
+                              std::size_t begin, std::size_t end, wchar_t prev)
 {
-    for (auto&& file: files) {
-        std::unique_ptr<WordCountLoad<>> load;
-        std::wifstream ifs;
-        std::wistream *is;
-        auto prev = L'a';
-
-        if (file == "stdin")
-            is = &std::wcin;
-        else {
-            ifs.open(file);
-            if (!ifs) {
-                log_err("Failed to open file " << file);
+    auto data = reinterpret_cast<const unsigned char *>(map->data());
+    std::size_t advised = begin;
+
+    for (std::size_t offset = begin; offset < end; ) {
+        auto next = Utf8::align(data, std::min(offset + m_sizer.size(), end), end);
+
+        if (offset >= advised) {
+            map->will_need(advised, MAP_READ_AHEAD);
+            advised += MAP_READ_AHEAD;
+        }
+
+        auto load = get_load<ByteLoad>(file);
+        load->map(map, offset, next - offset);
+        load->prev() = offset == begin ? prev : Utf8::prev_char(data, data + offset);
+        push(std::move(load));
+
+        offset = next;
+    }
+}
+
+Decompressor::Format WordCounter::compression(const unsigned char *data, std::size_t size)
+{
+    auto format = Decompressor::detect(data, size);
+
+    if (format == Decompressor::Format::NONE || Decompressor::supported(format))
+        return format;
+
+    std::call_once(m_decompress_warning, [] {
+        log_warn("Compressed input isn't supported by this build, counting it as is");
+    });
+
+    return Decompressor::Format::NONE;
+}
+
+void WordCounter::distribute_compressed(
+    FileId file, const std::shared_ptr<const MappedFile>& map, Decompressor::Format format)
+{
+    auto data = reinterpret_cast<const unsigned char *>(map->data());
+    auto units = Decompressor::units(format, data, map->size());
+
+    if (units.size() > 1 && m_config.max_threads > 1) {
+        distribute_units(file, map, format, units);
+        m_files.bytes(file) = map->size();
+    } else
+        decompress_stream(file, format, -1, data, map->size());
+}
+
+void WordCounter::distribute_units(FileId file, const std::shared_ptr<const MappedFile>& map,
+                                   Decompressor::Format format,
+                                   const std::vector<Decompressor::Unit>& units)
+{
+    auto data = reinterpret_cast<const unsigned char *>(map->data());
+    std::vector<std::shared_ptr<MappedFile>> outputs;
+    unsigned char carry[2 * Utf8::MAX_CARRY];
+    std::size_t carried = 0;
+    auto prev = L' ';
+
+    // the counting pool is busy with the run, the decompressors are only
+    // started once a file needs them and are shared by all readers
+    std::call_once(m_decompressors_started, [&] {
+        m_decompressors = std::make_unique<ThreadPool>(m_config.max_threads);
+    });
+    auto& pool = *m_decompressors;
+
+    for (std::size_t first = 0; first < units.size(); ) {
+        std::size_t last = first, window = 0;
+        std::atomic<bool> failed{false};
+
+        // the outputs are kept until their loads have been counted, so
+        // only a window of units is decompressed at once
+        while (last < units.size() && last - first < pool.size() * UNITS_PER_THREAD &&
+               (last == first || window + units[last].out_size <= DECOMPRESS_WINDOW))
+            window += units[last++].out_size;
+
+        outputs.assign(last - first, nullptr);
+        pool.run(last - first, [&] (std::size_t i) {
+            const auto& unit = units[first + i];
+
+            if (!unit.out_size)
+                return;
+
+            auto output = MappedFile::allocate(unit.out_size);
+            if (!output ||
+                !Decompressor::decompress_unit(
+                    format, data + unit.offset, unit.size,
+                    reinterpret_cast<unsigned char *>(output->writable()), unit.out_size)) {
+                failed = true;
+                return;
+            }
+            outputs[i] = std::move(output);
+        });
+
+        if (failed) {
+            m_files.read_error(file) = EBADMSG;
+            return;
+        }
+
+        // the loads map the outputs, only characters split between two
+        // units are copied into a load of their own
+        for (auto&& output: outputs) {
+            if (!output)
                 continue;
+
+            auto out = reinterpret_cast<const unsigned char *>(output->data());
+            std::size_t begin = 0;
+
+            while (carried && begin < output->size() && begin < Utf8::MAX_CARRY &&
+                   Utf8::is_continuation(out[begin]))
+                carry[carried++] = out[begin++];
+
+            if (carried) {
+                auto load = get_load<ByteLoad>(file);
+
+                std::memcpy(load->buffer(), carry, carried);
+                load->size() = carried;
+                load->prev() = prev;
+                prev = Utf8::prev_char(carry, carry + carried);
+                push(std::move(load));
+                carried = 0;
             }
-            is = &ifs;
+
+            auto end = begin + Utf8::boundary(out + begin, output->size() - begin);
+
+            push_mapped(file, output, begin, end, prev);
+            if (end > begin)
+                prev = Utf8::prev_char(out + begin, out + end);
+
+            carried = output->size() - end;
+            std::memcpy(carry, out + end, carried);
         }
 
-        auto handle_move = [&] (std::size_t idx) {
-            prev = (*load)[idx];
-            m_queue.push(std::move(load));
-        };
+        first = last;
+    }
+
+    if (carried) {
+        auto load = get_load<ByteLoad>(file);
+
+        std::memcpy(load->buffer(), carry, carried);
+        load->size() = carried;
+        load->prev() = prev;
+        push(std::move(load));
+    }
+}
+
+void WordCounter::decompress_stream(FileId file, Decompressor::Format format, int fd,
+                                    const unsigned char *in, std::size_t in_size)
+{
+    auto decompressor = Decompressor::create(format);
+    std::vector<unsigned char> input;
+    char carry[Utf8::MAX_CARRY];
+    std::size_t carried = 0;
+    auto prev = L' ';
+    auto done = false;
+    auto eof = fd < 0;
+
+    if (!decompressor) {
+        m_files.read_error(file) = ENOMEM;
+        return;
+    }
+
+    // input from a pipe is read into a buffer of its own, mapped input
+    // is decompressed in place
+    if (!eof) {
+        input.resize(std::max(COMPRESSED_BUFFER, in_size));
+        std::memcpy(input.data(), in, in_size);
+        in = input.data();
+    }
+    m_files.bytes(file) += in_size;
+
+    while (!done) {
+        auto load = get_load<ByteLoad>(file);
+        auto buffer = reinterpret_cast<unsigned char *>(load->buffer());
+        auto out = buffer + carried;
+        auto out_size = std::min(m_sizer.size(), m_config.chunk_size);
+
+        // characters must not be split between loads
+        std::memcpy(buffer, carry, carried);
 
-        while (42) {
-            load = std::make_unique<WordCountLoad<>>(config.chunk_size, file);
-            load->prev() = prev;
-            is->read(load->data(), config.chunk_size);
+        // decompressed right into the load, it isn't copied again
+        while (out_size) {
+            const auto left = in_size + out_size;
 
-            if (is->eof()) {
-                load->size() = is->gcount();
+            if (!decompressor->decompress(in, in_size, out, out_size)) {
+                m_files.read_error(file) = EBADMSG;
+                done = true;
                 break;
             }
+            if (in_size + out_size != left)
+                continue;
 
-            if (is->bad() || is->fail()) {
-                log_err("Failed to read from stream");
-                log_info("Counting results for file " << file << " will be incorrect");
-                goto next_file;
+            // no progress, more input is needed
+            if (eof) {
+                done = true;
+                break;
             }
 
-            handle_move(config.chunk_size - 1);
+            std::memmove(input.data(), in, in_size);
+            in = input.data();
+
+            auto ret = ::read(fd, input.data() + in_size, input.size() - in_size);
+            if (ret < 0 && errno == EINTR)
+                continue;
+            if (ret < 0) {
+                m_files.read_error(file) = errno;
+                done = true;
+                break;
+            }
+            if (!ret)
+                eof = true;
+            in_size += ret;
+            m_files.bytes(file) += ret;
         }
 
-        if (is->gcount() > 0)
-            handle_move(is->gcount() - 1);
+        const std::size_t size = out - buffer;
+        auto end = done ? size : Utf8::boundary(buffer, size);
 
-    next_file:
-        continue;
+        carried = size - end;
+        std::memcpy(carry, buffer + end, carried);
+
+        load->size() = end;
+        load->prev() = prev;
+        if (end) {
+            prev = Utf8::prev_char(buffer, buffer + end);
+            push(std::move(load));
+        } else
+            put_load(std::move(load));
     }
+
+    if (!m_files.read_error(file) && !decompressor->complete())
+        m_files.read_error(file) = EBADMSG;
+}
+
+/**
+ * Pipes default to 64 KiB, which wakes up the writer and the reader way
+ * too often for large chunks. Errors are ignored, it's only a hint.
+ */
+static void grow_pipe(int fd)
+{
+#ifdef F_SETPIPE_SZ
+    struct stat st;
+
+    if (!::fstat(fd, &st) && S_ISFIFO(st.st_mode))
+        ::fcntl(fd, F_SETPIPE_SZ, PIPE_SIZE);
+#else
+    (void)fd;
+#endif
 }
 
-void WordCounter::print_result(
-    const std::string& file, const WordCountResult& result) const
+void WordCounter::distribute_bytes(FileId file)
 {
-    if (config.flags & KwcNGOpt::PARSEABLE) {
-        std::cout << file << ";" << result.lines() << ";"
-                  << result.words() << ";" << result.chars() << std::endl;
+    const auto& name = m_files.name(file);
+    const auto is_stdin = name == "stdin";
+    char carry[Utf8::MAX_CARRY];
+    std::size_t carried = 0;
+    auto prev = L' ';
+    auto eof = false;
+    auto first = true;
+
+    int fd = is_stdin ? STDIN_FILENO : ::open(name.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        m_files.open_error(file) = errno;
         return;
     }
 
-    std::cout << "file: " << std::setw(24) << file;
-    if (config.flags & KwcNGOpt::LINES)
-        std::cout << " lines: " << std::setw(10) << result.lines();
-    if (config.flags & KwcNGOpt::WORDS)
-        std::cout << " words: " << std::setw(10) << result.words();
-    if (config.flags & KwcNGOpt::CHARS)
-        std::cout << " chars: " << std::setw(10) << result.chars();
-    std::cout << std::endl;
+    grow_pipe(fd);
+
+    while (!eof) {
+        auto load = get_load<ByteLoad>(file);
+        auto buffer = reinterpret_cast<unsigned char *>(load->buffer());
+        auto chunk = carried + std::min(m_sizer.size(), m_config.chunk_size);
+        auto size = carried;
+
+        // the magic number must be at hand, even for tiny chunks, which
+        // the load's room for carried characters makes up for
+        if (first)
+            chunk = std::max(chunk, Decompressor::MAGIC_SIZE);
+
+        // characters must not be split between loads
+        std::memcpy(buffer, carry, carried);
+
+        // pipes return at most what's buffered, fill the whole chunk anyway
+        while (size < chunk) {
+            auto ret = ::read(fd, buffer + size, chunk - size);
+
+            if (ret < 0 && errno == EINTR)
+                continue;
+            if (ret < 0) {
+                m_files.read_error(file) = errno;
+                put_load(std::move(load));
+                if (!is_stdin)
+                    ::close(fd);
+                return;
+            }
+            if (!ret) {
+                eof = true;
+                break;
+            }
+            size += ret;
+        }
+
+        // compressed input is recognized by its first bytes
+        auto format = first ? compression(buffer, size) : Decompressor::Format::NONE;
+        first = false;
+
+        if (format != Decompressor::Format::NONE) {
+            std::vector<unsigned char> prefix(buffer, buffer + size);
+
+            put_load(std::move(load));
+            decompress_stream(file, format, fd, prefix.data(), prefix.size());
+            if (!is_stdin)
+                ::close(fd);
+            return;
+        }
+
+        auto end = eof ? size : Utf8::boundary(buffer, size);
+
+        carried = size - end;
+        std::memcpy(carry, buffer + end, carried);
+        m_files.bytes(file) += end;
+
+        load->size() = end;
+        load->prev() = prev;
+        if (end) {
+            prev = Utf8::prev_char(buffer, buffer + end);
+            push(std::move(load));
+        } else
+            put_load(std::move(load));
+    }
+
+    if (!is_stdin)
+        ::close(fd);
+}
+
+void WordCounter::distribute_stream(FileId file)
+{
+    const auto& name = m_files.name(file);
+    std::wifstream ifs;
+    std::wistream *is;
+    auto prev = L' ';
+
+    if (name == "stdin")
+        is = &std::wcin;
+    else {
+        ifs.imbue(std::locale(""));
+        ifs.open(name);
+        if (!ifs) {
+            m_files.open_error(file) = errno ? errno : EIO;
+            return;
+        }
+        is = &ifs;
+    }
+
+    while (42) {
+        auto load = get_load<WideLoad>(file);
+
+        load->prev() = prev;
+        is->read(load->buffer(), std::min(m_sizer.size(), m_config.chunk_size));
+        load->size() = is->gcount();
+
+        if (is->bad() || (is->fail() && !is->eof())) {
+            m_files.read_error(file) = errno ? errno : EIO;
+            put_load(std::move(load));
+            return;
+        }
+
+        if (load->size()) {
+            prev = (*load)[load->size() - 1];
+            push(std::move(load));
+        } else
+            put_load(std::move(load));
+
+        if (is->eof())
+            break;
+    }
+}
+
+static std::string dir_name(const std::string& path)
+{
+    auto pos = path.rfind('/');
+
+    if (pos == std::string::npos)
+        return ".";
+
+    return pos ? path.substr(0, pos) : "/";
+}
+
+/**
+ * Character in front of @offset, so that words continue across appends.
+ */
+static wchar_t prev_char_at(const std::string& file, std::size_t offset)
+{
+    unsigned char buffer[Utf8::MAX_CARRY];
+    auto len = std::min(offset, sizeof(buffer));
+    ssize_t ret = -1;
+
+    int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        ret = ::pread(fd, buffer, len, offset - len);
+        ::close(fd);
+    }
+
+    return ret > 0 ? Utf8::prev_char(buffer, buffer + ret) : L' ';
 }
 
-void WordCounter::print_results() const
+void WordCounter::follow(Output& output)
 {
-    for (auto&& i: m_results)
-        print_result(i.first, i.second);
-    if (m_results.size() > 1)
-        print_result("global", m_global);
+    const std::chrono::milliseconds interval{m_config.follow_interval};
+    std::vector<unsigned char> buffer(FOLLOW_BUFFER);
+    std::vector<Followed> followed;
+    std::vector<std::string> dirs;
+    FileWatch watch;
+    auto deadline = Clock::now() + interval;
+    auto dirty = false;
+
+    if (!Utf8::locale_is_utf8()) {
+        log_warn("Follow mode requires a UTF-8 locale");
+        return;
+    }
+
+    // the updates report all files again
+    m_streaming = false;
+
+    m_results.resize(m_files.size());
+    for (FileId file = 0; file < m_files.size(); ++file) {
+        const auto& name = m_files.name(file);
+        struct stat st;
+
+        m_results[file].file() = file;
+        if (name == "stdin" || m_files.open_error(file) || m_files.read_error(file) ||
+            ::stat(name.c_str(), &st) || !S_ISREG(st.st_mode) || is_compressed(name))
+            continue;
+
+        followed.push_back({file, static_cast<std::uint64_t>(st.st_dev),
+                            static_cast<std::uint64_t>(st.st_ino), m_files.bytes(file),
+                            prev_char_at(name, m_files.bytes(file))});
+
+        auto dir = dir_name(name);
+        if (std::find(dirs.begin(), dirs.end(), dir) == dirs.end()) {
+            dirs.push_back(dir);
+            watch.add(dir);
+        }
+    }
+
+    if (followed.empty())
+        return;
+
+    while (42) {
+        auto now = Clock::now();
+
+        // busy files would wake us up all the time, so only the first
+        // change within an interval is waited for
+        if (now < deadline) {
+            auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - now + std::chrono::milliseconds(1));
+
+            if (dirty)
+                std::this_thread::sleep_until(deadline);
+            else
+                dirty = watch.wait(timeout);
+            continue;
+        }
+        deadline = now + interval;
+
+        if (!dirty)
+            continue;
+        dirty = false;
+
+        auto changed = false;
+        for (auto&& entry: followed)
+            changed |= update(entry, buffer);
+        if (!changed)
+            continue;
+
+        m_global = WordCountResult{};
+        for (auto&& result: m_results)
+            m_global += result;
+        report(output);
+    }
+}
+
+bool WordCounter::update(Followed& followed, std::vector<unsigned char>& buffer)
+{
+    const auto& name = m_files.name(followed.file);
+    auto& result = m_results[followed.file];
+    auto changed = false;
+    struct stat st;
+
+    // a rotated file may not have been recreated yet
+    int fd = ::open(name.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    if (::fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+        ::close(fd);
+        return false;
+    }
+
+    const std::size_t size = st.st_size;
+
+    // replaced or truncated, start over
+    if (st.st_dev != followed.dev || st.st_ino != followed.ino || size < followed.offset) {
+        result = WordCountResult{};
+        result.file() = followed.file;
+        followed.dev = st.st_dev;
+        followed.ino = st.st_ino;
+        followed.offset = 0;
+        followed.prev = L' ';
+        changed = true;
+    }
+
+    while (followed.offset < size) {
+        auto ret = ::pread(fd, buffer.data(), std::min(buffer.size(), size - followed.offset),
+                           followed.offset);
+
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            break;
+
+        // an incomplete character is counted once it has been written completely
+        auto end = Utf8::boundary(buffer.data(), ret);
+        if (!end)
+            break;
+
+        CountKernel::Counts counts;
+        bool prev_space = std::iswspace(followed.prev);
+
+        m_count_bytes(buffer.data(), end, prev_space, counts);
+        result += to_result(followed.file, counts, end);
+        followed.prev = Utf8::prev_char(buffer.data(), buffer.data() + end);
+        followed.offset += end;
+        changed = true;
+    }
+
+    ::close(fd);
+
+    return changed;
+}
+
+/**
+ * Called by the result stream for one file at a time. The result is only
+ * kept, if the cache or follow mode need it later on.
+ */
+void WordCounter::emit(const WordCountResult& result)
+{
+    const auto file = result.file();
+
+    m_global += result;
+    if (m_keep_results) {
+        if (file >= m_results.size())
+            m_results.resize(file + 1);
+        m_results[file] += result;
+        m_results[file].file() = file;
+    }
+
+    if (!m_files.open_error(file))
+        m_output->file(m_files.name(file), result);
+}
+
+/**
+ * Hands the results which haven't been streamed to @output, followed by
+ * the totals.
+ */
+void WordCounter::report(Output& output)
+{
+    if (m_streaming)
+        m_stream.finish();
+
+    for (FileId file = 0; !m_streaming && file < m_files.size(); ++file) {
+        // files without any load have not been merged
+        const auto& result = file < m_results.size() ? m_results[file] : WordCountResult{};
+
+        if (!m_files.open_error(file))
+            output.file(m_files.name(file), result);
+    }
+
+    output.done(m_global);
+}
+
+void WordCounter::print_stats(std::ostream& os) const
+{
+    std::size_t bytes = 0;
+
+    if (!m_stats.enabled())
+        return;
+
+    for (FileId file = 0; file < m_files.size(); ++file)
+        bytes += m_files.bytes(file);
+
+    std::size_t capacity = 0;
+    for (auto&& queue: m_queues)
+        capacity += queue->capacity();
+
+    m_stats.print_json(os, m_files.size(), bytes, capacity);
 }
@@ -29,39 +29,343 @@
 #include <thread>
 #include <vector>
 #include <string>
-#include <unordered_map>
+#include <string_view>
+#include <ostream>
+#include <variant>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <type_traits>
 
+#include "config.h"
 #include "concurrent_queue.h"
+#include "inflight_limit.h"
+#include "load_pool.h"
+#include "file_table.h"
+#include "dir_walker.h"
+#include "range_scheduler.h"
+#include "chunk_sizer.h"
+#include "count_cache.h"
+#include "pipeline_stats.h"
+#include "word_frequencies.h"
+#include "result_stream.h"
+#include "thread_pool.h"
+#include "buffer_counter.h"
+#include "decompressor.h"
+#include "io_ring.h"
 #include "word_count_result.h"
 #include "word_count_load.h"
+#include "mapped_file.h"
+#include "count_kernel.h"
 
+/**
+ * Counts files and buffers.
+ *
+ * The counting threads are started once and kept until the counter is
+ * destroyed, so a counter may be used for any number of runs. Runs and
+ * buffers are counted one at a time. The counter doesn't print anything
+ * but errors, the results are handed to an Output.
+ */
 class WordCounter
 {
 public:
     using Files = std::vector<std::string>;
+    using ByteLoad = WordCountLoad<char>;
+    using WideLoad = WordCountLoad<wchar_t>;
+    using Work = std::variant<std::unique_ptr<ByteLoad>, std::unique_ptr<WideLoad>>;
 
-    WordCounter()
-    {}
+    using WideCount = void (*)(const wchar_t *data, std::size_t size,
+                               bool& prev_space, CountKernel::Counts& counts);
 
-    void count_thread();
+    /**
+     * Receives the results of a run. file() is called for every file which
+     * could be opened, as soon as it has been counted, one at a time but
+     * from any thread. done() gets the totals once all files are through.
+     */
+    class Output
+    {
+    public:
+        virtual ~Output() = default;
 
-    void distribute_work(const Files& files);
+        virtual void file(const std::string& name, const WordCountResult& result) = 0;
+        virtual void done(const WordCountResult& global) = 0;
+    };
 
-    void print_results() const;
+    /**
+     * The config is copied, so that several counters may use different
+     * settings.
+     */
+    explicit WordCounter(const KwcNGConfig& config);
 
-    void stop()
+    /**
+     * Counts the files, "stdin" is the standard input. If CPUs are given,
+     * reading starts once all counting threads have been placed on them.
+     * The counts are stored in the cache, if one is used.
+     */
+    void run(const Files& files, Output& output);
+
+    /**
+     * Counts @data on its own.
+     */
+    WordCountResult count(std::string_view data)
+    {
+        return m_buffers.count(data);
+    }
+
+    /**
+     * Counts a stream of buffers, which may split characters and words.
+     */
+    void feed(std::string_view data)
+    {
+        m_buffers.feed(data);
+    }
+
+    /**
+     * Returns the counts of everything fed since the last call and starts
+     * over.
+     */
+    WordCountResult finish()
+    {
+        return m_buffers.finish();
+    }
+
+    /**
+     * Most frequent words of the last run, if they have been requested.
+     */
+    const std::vector<WordFrequencies::Word>& words() const noexcept
     {
-        m_queue.wake_up();
+        return m_freq.words();
     }
 
+    const ChunkSizer& sizer() const noexcept
+    {
+        return m_sizer;
+    }
+
+    /**
+     * Writes the pipeline stats of the last run as JSON, if they have been
+     * requested.
+     */
+    void print_stats(std::ostream& os) const;
+
+    /**
+     * Counts what's appended to the regular files of the last run and
+     * hands all results to @output again on every change. Doesn't return.
+     */
+    void follow(Output& output);
+
 private:
-    WordCountResult count(const WordCountLoad<>& load) const;
-    void print_result(const std::string& file, const WordCountResult& result) const;
+    /**
+     * Word state at the edges of a counted range of a file.
+     */
+    struct RangeEdges {
+        FileId file;
+        std::size_t begin;
+        std::size_t end;
+        bool starts_in_word;
+        bool ends_in_word;
+    };
+
+    /**
+     * Result of one file, summed up by a counting thread. Every slot fills
+     * a cache line of its own, so the threads' arrays never share one.
+     */
+    struct alignas(CACHE_LINE_SIZE) ResultSlot {
+        WordCountResult result;
+    };
+
+    /**
+     * Position up to which a followed file has been counted.
+     */
+    struct Followed {
+        FileId file;
+        std::uint64_t dev;
+        std::uint64_t ino;
+        std::size_t offset;
+        wchar_t prev;
+    };
+
+    /**
+     * Cache record of a file. Unless its counts have been taken from the
+     * file which has been looked up, the file is read again by name.
+     */
+    struct CacheEntry {
+        FileId file;
+        CountCache::Record record;
+        bool counted;
+    };
+
+    void count_thread(std::size_t worker);
+    void distribute_work(const Files& files);
+    void save_cache();
+    void report(Output& output);
+
+    void stop()
+    {
+        for (auto&& queue: m_queues)
+            queue->wake_up();
+    }
+
+    void count_ranges(std::size_t worker, std::vector<ResultSlot>& results,
+                      std::vector<RangeEdges>& edges);
+    static void accumulate(std::vector<ResultSlot>& results, const WordCountResult& result);
+    void join_ranges();
+    template<typename Sink>
+    void count(const ByteLoad& load, Sink&& sink) const;
+    template<typename Sink>
+    void count(const WideLoad& load, Sink&& sink) const;
+    bool cached(FileId file, bool utf8, std::unique_ptr<ByteLoad>& batch);
+    bool update(Followed& followed, std::vector<unsigned char>& buffer);
+    void add_cached(FileId file, const CountCache::Record& record);
+    void add_result(const WordCountResult& result);
+    void emit(const WordCountResult& result);
+    bool from_metadata(FileId file);
+    std::size_t place(std::size_t worker);
+    Work pop(std::size_t node);
+    std::unique_ptr<ByteLoad> get_byte_load();
+    std::size_t encoded_size(const WideLoad& load) const;
+    void tokenize(const ByteLoad& load, WordFrequencies::Local& local) const;
+    void distribute_mapped(FileId file, const std::shared_ptr<const MappedFile>& map,
+                           std::size_t start = 0);
+    void push_mapped(FileId file, const std::shared_ptr<const MappedFile>& map,
+                     std::size_t begin, std::size_t end, wchar_t prev);
+    Decompressor::Format compression(const unsigned char *data, std::size_t size);
+    void distribute_compressed(FileId file, const std::shared_ptr<const MappedFile>& map,
+                               Decompressor::Format format);
+    void distribute_units(FileId file, const std::shared_ptr<const MappedFile>& map,
+                          Decompressor::Format format,
+                          const std::vector<Decompressor::Unit>& units);
+    void decompress_stream(FileId file, Decompressor::Format format, int fd,
+                           const unsigned char *in, std::size_t in_size);
+    void distribute_bytes(FileId file);
+    void distribute_stream(FileId file);
+    void read_files(bool utf8);
+    void batch_file(FileId file, std::size_t size, std::unique_ptr<ByteLoad>& batch,
+                    int fd = -1);
+#ifdef KWCNG_IO_URING
+    bool distribute_uring(FileId file, IoRing& ring);
+#endif
+
+    /**
+     * Node of the buffer of a byte load. Wide loads are spread over all
+     * nodes.
+     */
+    template<typename Load>
+    std::size_t node(const Load& load) const noexcept
+    {
+        if constexpr (std::is_same_v<Load, ByteLoad>)
+            return load.index() / m_node_loads;
+        else
+            return load.index() % m_queues.size();
+    }
+
+    template<typename Load>
+    std::unique_ptr<Load> get_load(FileId file)
+    {
+        std::unique_ptr<Load> load;
+
+        if constexpr (std::is_same_v<Load, ByteLoad>)
+            load = get_byte_load();
+        else
+            load = m_wide_pool.get();
+
+        load->reset(file);
+
+        return load;
+    }
+
+    template<typename Load>
+    void put_load(std::unique_ptr<Load>&& load)
+    {
+        if constexpr (std::is_same_v<Load, ByteLoad>)
+            m_byte_pools[node(*load)]->put(std::move(load));
+        else
+            m_wide_pool.put(std::move(load));
+    }
+
+    /**
+     * Sequence number of the next load queued by the calling reader.
+     */
+    static std::size_t& next_sequence() noexcept;
+
+    /**
+     * Queues the load to the counting threads on the node of its buffer.
+     */
+    template<typename Load>
+    void push(std::unique_ptr<Load>&& load)
+    {
+        const auto bytes = load->size() * sizeof(*load->data());
+        auto& queue = *m_queues[node(*load)];
+
+        load->sequence() = next_sequence()++;
+
+        // batched files hold their references from the moment they're added
+        if (m_streaming && load->segments().empty())
+            m_stream.ref(load->file());
+
+        if (!m_stats.enabled()) {
+            m_inflight.acquire(bytes);
+            queue.push(std::move(load));
+            return;
+        }
+
+        auto& stats = PipelineStats::reader();
+        auto start = PipelineStats::Clock::now();
+
+        m_inflight.acquire(bytes);
+        queue.push(std::move(load));
+
+        // the indices are read one after another, so it's approximate
+        auto depth = queue.size();
+        if (depth <= queue.capacity() && depth > stats.max_depth)
+            stats.max_depth = depth;
+        stats.blocked_ns += PipelineStats::ns(PipelineStats::Clock::now() - start);
+        stats.loads++;
+        stats.bytes += bytes;
+    }
 
+    KwcNGConfig m_config;
+    std::vector<std::size_t> m_worker_nodes;
+    std::size_t m_queue_capacity;
+    std::size_t m_node_loads;
+    CountKernel::Count m_count_bytes;
+    WideCount m_count_wide;
     WordCountResult m_global;
-    ConcurrentQueue<std::unique_ptr<WordCountLoad<>>> m_queue;
-    std::unordered_map<std::string, WordCountResult> m_results;
+    std::vector<std::unique_ptr<ConcurrentQueue<Work>>> m_queues;
+    InflightLimit m_inflight;
+    std::vector<std::unique_ptr<LoadPool<ByteLoad>>> m_byte_pools;
+    LoadPool<WideLoad> m_wide_pool;
+    FileTable m_files;
+    DirWalker m_walker;
+    std::vector<WordCountResult> m_results;
+    std::vector<std::shared_ptr<const MappedFile>> m_maps;
+    RangeScheduler m_scheduler;
+    ChunkSizer m_sizer;
+    std::vector<RangeEdges> m_edges;
+    std::unique_ptr<CountCache> m_cache;
+    std::uint32_t m_cache_mask;
+    std::vector<CacheEntry> m_cache_records;
+    PipelineStats m_stats;
+    WordFrequencies m_freq;
+    bool m_streaming;
+    bool m_keep_results;
+    Output *m_output;
+    ResultStream m_stream;
+    std::atomic<std::size_t> m_next_node;
+    std::size_t m_finished;
+    std::size_t m_placed;
     std::mutex m_mutex;
+    std::condition_variable m_placed_cv;
+    std::once_flag m_uring_warning;
+    std::once_flag m_pin_warning;
+    std::once_flag m_decompress_warning;
+    std::once_flag m_decompressors_started;
+    std::unique_ptr<ThreadPool> m_decompressors;
+    // the pool's tasks use the members above, so its threads are joined
+    // before those are destroyed. The buffer counter goes first, it only
+    // refers to the pool and none of its tasks run once a call returned.
+    ThreadPool m_pool;
+    BufferCounter m_buffers;
 };
 
 #endif /* _WORD_COUNTER_H_ */
@@ -0,0 +1,280 @@
+// Copyright 2018 Kurt Kanzenbach <kurt@kmk-computers.de>
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef _WORD_FREQUENCIES_H_
+#define _WORD_FREQUENCIES_H_
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <functional>
+#include <string_view>
+#include <cstddef>
+
+#include "utf8.h"
+#include "file_table.h"
+#include "word_table.h"
+#include "thread_pool.h"
+
+/**
+ * Occurrences of every word.
+ *
+ * The counting threads tokenize their loads into tables of their own.
+ * Words are separated by the same whitespace as for the word count. A
+ * load only knows its own data, so the text in front of its first and
+ * after its last whitespace is kept as fragment. Once all loads are done
+ * the fragments are ordered by their position in the file and stitched
+ * together.
+ *
+ * Each table is split into hash shards once it's handed over. Afterwards
+ * the shards are merged in parallel, every task only walks the words of
+ * its own shard. Each shard selects its most frequent words with a heap
+ * and the shards' selections are combined.
+ */
+class WordFrequencies
+{
+public:
+    using Word = std::pair<std::string_view, std::size_t>;
+
+    struct Fragment {
+        FileId file;
+        std::size_t sequence;
+        std::string head;
+        std::string tail;
+        bool spaceless;
+    };
+
+    struct Local {
+        WordTable table;
+        std::vector<Fragment> fragments;
+        std::vector<std::vector<const WordTable::Entry *>> shards;
+    };
+
+    explicit WordFrequencies(std::size_t shards) :
+        m_shard_count{std::max<std::size_t>(shards, 1)}
+    {}
+
+    /**
+     * Tokenizes a load. If @complete, the data is a whole file and there
+     * is nothing to stitch.
+     */
+    static void tokenize(const unsigned char *data, std::size_t size, FileId file,
+                         std::size_t sequence, bool complete, Local& local)
+    {
+        const auto end = data + size;
+        Fragment fragment{file, sequence, {}, {}, true};
+        auto p = data;
+
+        while (p < end) {
+            // whitespace
+            while (p < end) {
+                auto len = space(p, end);
+
+                if (!len)
+                    break;
+                fragment.spaceless = false;
+                p += len;
+            }
+            if (p == end)
+                break;
+
+            // word
+            auto start = p++;
+            while (p < end && !space(p, end))
+                ++p;
+
+            auto word = reinterpret_cast<const char *>(start);
+            if (complete || (p < end && !fragment.spaceless))
+                local.table.add(word, p - start);
+            else if (fragment.spaceless)
+                fragment.head.assign(word, p - start);
+            else
+                fragment.tail.assign(word, p - start);
+        }
+
+        if (!complete)
+            local.fragments.push_back(std::move(fragment));
+    }
+
+    /**
+     * Takes over the table of a counting thread, which is split into
+     * shards before the lock is taken.
+     */
+    void add(Local&& local)
+    {
+        split(local);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        m_locals.push_back(std::move(local));
+    }
+
+    /**
+     * Stitches the fragments and merges the shards on @pool. Keeps the
+     * @top most frequent words, or all of them if zero.
+     */
+    void merge(ThreadPool& pool, std::size_t top)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::vector<std::vector<Word>> selected(m_shard_count);
+
+        stitch();
+
+        // the words of the previous run are dropped
+        m_shards.clear();
+        m_shards.resize(m_shard_count);
+        pool.run(m_shard_count, [&] (std::size_t shard) {
+            auto& table = m_shards[shard];
+
+            for (auto&& local: m_locals)
+                for (auto entry: local.shards[shard])
+                    table.merge(*entry);
+            select(table, top, selected[shard]);
+        });
+
+        m_words.clear();
+        for (auto&& words: selected)
+            m_words.insert(m_words.end(), words.begin(), words.end());
+        std::sort(m_words.begin(), m_words.end(), more_frequent);
+        if (top && m_words.size() > top)
+            m_words.resize(top);
+
+        // the words point into the tables of this run, the ones of the
+        // previous run aren't needed anymore
+        m_merged.swap(m_locals);
+        m_locals.clear();
+    }
+
+    /**
+     * Most frequent words first, ties in byte order.
+     */
+    const std::vector<Word>& words() const noexcept
+    {
+        return m_words;
+    }
+
+private:
+    /**
+     * Length of the whitespace character at @p, zero if it's none.
+     */
+    static std::size_t space(const unsigned char *p, const unsigned char *end) noexcept
+    {
+        if (*p < 0x80)
+            return Utf8::is_ascii_space(*p);
+        if (*p < 0xe1 || *p > 0xe3)
+            return 0;
+
+        return Utf8::is_space(p, end) ? 3 : 0;
+    }
+
+    /**
+     * The entries stay where they are, the table doesn't change anymore.
+     */
+    void split(Local& local) const
+    {
+        local.shards.resize(m_shard_count);
+        local.table.for_each([&] (const WordTable::Entry& entry) {
+            // the low bits pick the slot within the shard
+            local.shards[(entry.hash >> 40) % m_shard_count].push_back(&entry);
+        });
+    }
+
+    static bool more_frequent(const Word& a, const Word& b) noexcept
+    {
+        return a.second > b.second || (a.second == b.second && a.first < b.first);
+    }
+
+    static void select(const WordTable& table, std::size_t top, std::vector<Word>& words)
+    {
+        table.for_each([&] (const WordTable::Entry& entry) {
+            Word word{std::string_view(entry.key, entry.len), entry.count};
+
+            if (!top) {
+                words.push_back(word);
+                return;
+            }
+
+            // the heap's front is the least frequent of the selection
+            if (words.size() < top) {
+                words.push_back(word);
+                std::push_heap(words.begin(), words.end(), more_frequent);
+            } else if (more_frequent(word, words.front())) {
+                std::pop_heap(words.begin(), words.end(), more_frequent);
+                words.back() = word;
+                std::push_heap(words.begin(), words.end(), more_frequent);
+            }
+        });
+    }
+
+    void stitch()
+    {
+        std::vector<Fragment *> fragments;
+        Local stitched;
+        std::string word;
+        auto file = FileId{0};
+
+        for (auto&& local: m_locals)
+            for (auto&& fragment: local.fragments)
+                fragments.push_back(&fragment);
+        std::sort(fragments.begin(), fragments.end(), [] (auto a, auto b) {
+            return a->file < b->file || (a->file == b->file && a->sequence < b->sequence);
+        });
+
+        auto flush = [&] {
+            if (!word.empty())
+                stitched.table.add(word.data(), word.size());
+            word.clear();
+        };
+
+        for (auto fragment: fragments) {
+            if (fragment->file != file)
+                flush();
+            file = fragment->file;
+
+            word += fragment->head;
+            if (fragment->spaceless)
+                continue;
+            flush();
+            word = fragment->tail;
+        }
+        flush();
+
+        for (auto&& local: m_locals)
+            local.fragments.clear();
+        split(stitched);
+        m_locals.push_back(std::move(stitched));
+    }
+
+    std::size_t m_shard_count;
+    std::vector<Local> m_locals;
+    std::vector<Local> m_merged;
+    std::vector<WordTable> m_shards;
+    std::vector<Word> m_words;
+    std::mutex m_mutex;
+};
+
+#endif /* _WORD_FREQUENCIES_H_ */
@@ -0,0 +1,182 @@
+// Copyright 2018 Kurt Kanzenbach <kurt@kmk-computers.de>
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef _WORD_TABLE_H_
+#define _WORD_TABLE_H_
+
+#include <memory>
+#include <vector>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Open addressing hash table counting words.
+ *
+ * The table is probed linearly and grows at half load. The keys are
+ * copied into an arena of large blocks, which are never moved or freed
+ * before the table, so the entries may keep plain pointers. merge()
+ * doesn't copy the key at all, the source of the entry has to outlive
+ * the table then.
+ */
+class WordTable
+{
+public:
+    struct Entry {
+        const char *key;
+        std::size_t len;
+        std::uint64_t hash;
+        std::size_t count;
+    };
+
+    WordTable() :
+        m_entries(INITIAL_SIZE), m_used{0}, m_arena{nullptr}, m_arena_left{0}
+    {}
+
+    static std::uint64_t hash(const char *key, std::size_t len) noexcept
+    {
+        std::uint64_t hash = 0xcbf29ce484222325ULL;
+
+        for (std::size_t i = 0; i < len; ++i)
+            hash = (hash ^ static_cast<unsigned char>(key[i])) * 0x100000001b3ULL;
+
+        // FNV leaves the upper bits weak for short keys
+        hash ^= hash >> 32;
+
+        return hash;
+    }
+
+    void add(const char *key, std::size_t len, std::size_t count = 1)
+    {
+        auto& entry = find(key, len, hash(key, len));
+
+        if (!entry.key) {
+            entry.key = store(key, len);
+            m_used++;
+        }
+        entry.count += count;
+
+        // invalidates the entry
+        if (m_used * 2 > m_entries.size())
+            grow();
+    }
+
+    void merge(const Entry& other)
+    {
+        auto& entry = find(other.key, other.len, other.hash);
+
+        if (!entry.key) {
+            entry.key = other.key;
+            m_used++;
+        }
+        entry.count += other.count;
+
+        if (m_used * 2 > m_entries.size())
+            grow();
+    }
+
+    std::size_t size() const noexcept
+    {
+        return m_used;
+    }
+
+    template<typename Func>
+    void for_each(Func&& func) const
+    {
+        for (auto&& entry: m_entries)
+            if (entry.key)
+                func(entry);
+    }
+
+private:
+    static constexpr std::size_t INITIAL_SIZE = 1024;
+    static constexpr std::size_t ARENA_BLOCK = 1024 * 1024;
+
+    Entry& find(const char *key, std::size_t len, std::uint64_t hash)
+    {
+        const auto mask = m_entries.size() - 1;
+
+        for (auto i = hash & mask; ; i = (i + 1) & mask) {
+            auto& entry = m_entries[i];
+
+            if (!entry.key) {
+                entry.len = len;
+                entry.hash = hash;
+                entry.count = 0;
+                return entry;
+            }
+            if (entry.hash == hash && entry.len == len && !std::memcmp(entry.key, key, len))
+                return entry;
+        }
+    }
+
+    void grow()
+    {
+        std::vector<Entry> entries(m_entries.size() * 2);
+        const auto mask = entries.size() - 1;
+
+        for (auto&& entry: m_entries) {
+            if (!entry.key)
+                continue;
+
+            auto i = entry.hash & mask;
+            while (entries[i].key)
+                i = (i + 1) & mask;
+            entries[i] = entry;
+        }
+        m_entries.swap(entries);
+    }
+
+    const char *store(const char *key, std::size_t len)
+    {
+        // long words get a block of their own
+        if (len > m_arena_left) {
+            auto size = len > ARENA_BLOCK / 4 ? len : ARENA_BLOCK;
+
+            m_blocks.emplace_back(new char[size]);
+            if (size != ARENA_BLOCK) {
+                std::memcpy(m_blocks.back().get(), key, len);
+                return m_blocks.back().get();
+            }
+            m_arena = m_blocks.back().get();
+            m_arena_left = size;
+        }
+
+        auto copy = m_arena;
+        std::memcpy(copy, key, len);
+        m_arena += len;
+        m_arena_left -= len;
+
+        return copy;
+    }
+
+    std::vector<Entry> m_entries;
+    std::size_t m_used;
+    std::vector<std::unique_ptr<char[]>> m_blocks;
+    char *m_arena;
+    std::size_t m_arena_left;
+};
+
+#endif /* _WORD_TABLE_H_ */